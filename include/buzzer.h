@@ -0,0 +1,34 @@
+// buzzer.h
+// KidsBar: the Tamagotchi buzzer on an LEDC PWM pin, in step with emulated time.
+//
+// HOW IT WORKS:
+// - TamaLib reports tone changes through the HAL (set_frequency / play_frequency)
+//   from inside cpu_step(). The ROM rewrites the buzzer registers constantly, so
+//   only actual changes go further.
+// - Each change is stamped with the emulated tick it happened at, converted to the
+//   esp_timer time that tick is due (lowPowerUsAt()) and posted to a queue without
+//   waiting. A driver task sleeps until the change is due and reprograms LEDC.
+// - The emulator runs ahead of real time in batches and falls behind during E-ink
+//   refreshes. A change that arrives late is played at once and the rest of the
+//   tune keeps its spacing from there. Changes later than BUZZER_MAX_LAG_MS collapse
+//   into their final state (catch-up after a sleep, long refresh).
+// - The task only wakes for changes. While a tone plays the chip does not light-sleep
+//   (LEDC stops in light sleep); see buzzerBusy().
+#pragma once
+
+#include <Arduino.h>
+#include "hal_types.h"
+
+// Configure LEDC on `pin` and start the driver task (-1 = no buzzer fitted). Changes
+// reported before this are not played; the state they left is.
+void buzzerBegin(int pin);
+
+// HAL side, from cpu_step(): tone frequency (Hz) and whether it sounds.
+void buzzerSetFrequency(u32_t hz);
+void buzzerPlay(bool on);
+
+// True while a tone sounds or changes are waiting to be played.
+bool buzzerBusy();
+
+// Changes lost to a full queue since boot (the final state is still played).
+uint32_t buzzerDropped();
@@ -21,6 +21,13 @@
 #define ENC_DT_PIN 1    // Encoder DT (Phase B) - PCNT compatible
 #define ENC_SW_PIN 21   // Encoder push button (active low)
 
+// Supply sense for the power-fail save (see power_fail.h)
+#define POWER_SENSE_PIN -1          // GPIO that changes level when the supply drops (-1 = not fitted)
+#define POWER_SENSE_FAIL_LEVEL LOW  // Level on that pin once power is lost
+
+// Piezo buzzer, driven by LEDC (see buzzer.h)
+#define BUZZER_PIN -1        // GPIO of the buzzer (-1 = not fitted)
+
 // WS2812B RGB LED Pins
 #define NEOPIXEL_PIN 15      // External WS2812B data pin
 #define NEOPIXEL_COUNT 1     // Number of LEDs
@@ -35,6 +42,76 @@
 #define ANIMATION_FRAME_MS (500UL)           // Animation frame delay
 #define IDLE_SLEEP_TIMEOUT_MS (300000UL)     // Sleep after 5 minutes idle
 
+// Emulator Display Rate
+// The E-ink is refreshed at up to EMU_FPS_MAX while the Tamagotchi LCD animates
+// or right after an input, then backs off to one refresh every EMU_IDLE_REFRESH_S
+// seconds (0 = refresh only after inputs). Unchanged frames are never refreshed.
+#define EMU_FPS_MAX 3
+#define EMU_IDLE_REFRESH_S 30
+
+// Cold-start warm-up: emulated ticks (32768 per second) run before the main loop so
+// the ROM finishes initializing. Skipped entirely when a saved game is restored.
+#define BOOT_WARMUP_TICKS (3UL * 32768UL)
+
+// Emulated ticks one loop() iteration runs (~8 ms, a few dozen instructions).
+// Input, saves, power-fail capture and pacing are only handled between batches; a
+// batch ends early at the next queued button change so presses keep their tick.
+#define LOOP_BATCH_TICKS 256
+
+// What a refresh shows of the LCD frames since the previous one (see lcd_history.h):
+// LCD_RENDER_LATEST, LCD_RENDER_DOMINANT or LCD_RENDER_GHOST (intermediate frames dotted)
+#define EMU_RENDER_POLICY LCD_RENDER_GHOST
+
+// Save Triggers (see save_trigger.h)
+// The game is saved when enough RAM changed or shortly after button presses,
+// within a flash-write budget of SAVE_BUDGET_BURST writes plus one per refill period.
+#define SAVE_DIRTY_NIBBLES 32                // RAM nibbles changed since the last save
+#define SAVE_INPUT_QUIET_MS (5000UL)         // Save once buttons were idle this long
+#define SAVE_MAX_AGE_MS (1800000UL)          // Save any change at least every 30 minutes
+#define SAVE_BUDGET_BURST 4                  // Writes allowed back to back
+#define SAVE_BUDGET_REFILL_MS (180000UL)     // One more write every 3 minutes
+#define SAVE_PICKER_TIMEOUT_MS (10000UL)     // Slot picker and menus give up after this idle
+
+// Low Power (see low_power.h)
+// The emulator is paced to real time. Without input for LOW_POWER_IDLE_MS it sleeps
+// until the next emulated timer interrupt; after IDLE_SLEEP_TIMEOUT_MS without input
+// and LOW_POWER_DEEP_QUIET_MS without LCD change it deep-sleeps LOW_POWER_DEEP_SLEEP_S.
+#define LOW_POWER_ENABLED 1
+#define LOW_POWER_LIGHT_SLEEP 1              // 0 = delay() instead (keeps USB serial up)
+#define LOW_POWER_IDLE_MS (10000UL)          // No input this long = idle
+#define LOW_POWER_ACTIVE_AHEAD_MS 20         // Run-ahead of real time allowed while active
+#define LOW_POWER_LIGHT_MIN_MS 5             // Shorter waits are not worth a light sleep
+#define LOW_POWER_IDLE_SLICE_MS 250          // Shortest idle sleep (LCD latency while idle)
+#define LOW_POWER_DEEP_QUIET_MS (60000UL)    // LCD unchanged this long before deep sleep
+#define LOW_POWER_DEEP_SLEEP_S 120           // Deep sleep length, emulated on wake
+
+// Button Timing
+// In periods of the 256 Hz clock behind the ROM's programmable timer (128 emulated
+// ticks), so presses last the same emulated time at any emulation speed. Gestures
+// send presses of at least BTN_HOLD_PERIODS.
+#define BTN_HOLD_PERIODS 13                  // ~50 ms down
+#define BTN_GAP_PERIODS 13                   // ~50 ms up before the same button goes down again
+
+// Encoder Gestures (see gestures.h)
+// Actions: GESTURE_NONE, a chord (GESTURE_A ... GESTURE_ABC), GESTURE_REWIND, GESTURE_RESET
+// or GESTURE_SLOTS.
+#define GESTURE_CLICK GESTURE_B
+#define GESTURE_DOUBLE_CLICK GESTURE_AC      // Sound on/off (GESTURE_NONE = clicks without delay)
+#define GESTURE_LONG_PRESS GESTURE_SLOTS     // GESTURE_NONE = hold B while the button is held
+#define GESTURE_VERY_LONG_PRESS GESTURE_RESET
+#define GESTURE_DOUBLE_MS 300                // Second press within this after a release
+#define GESTURE_LONG_MS 800
+#define GESTURE_VERY_LONG_MS 5000
+#define GESTURE_ACCEL_MS 60                  // Detents this close send 2 taps, a third as close 3...
+#define GESTURE_ACCEL_MAX 3                  // ...up to this many (1 = no acceleration)
+#define GESTURE_REWIND_BACK 10               // Emulated seconds GESTURE_REWIND goes back
+
+// Buzzer (see buzzer.h)
+// Tone changes are played at the real time of the emulated tick they happened at.
+// Build with -D ENABLE_BUZZER_TRACE to also print them on the serial port (buzzer_trace.h).
+#define BUZZER_QUEUE_LEN 32                  // Tone changes waiting for their time
+#define BUZZER_MAX_LAG_MS 500                // Later than this, a tune collapses to its final state
+
 // Display Settings
 #define SCREEN_WIDTH 296
 #define SCREEN_HEIGHT 128
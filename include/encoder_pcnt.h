@@ -45,18 +45,24 @@
 //    - Range: 0-50ms
 //    - Try: 0 (no filtering), 10 (current), 30 (more filtering)
 //
-// 5. ENC_DEBUG (current: 2)
-//    - 0 = disabled, 1 = basic debug, 2 = verbose (every 100ms poll)
-//    - Verbose mode shows PCNT values and GPIO levels for diagnostics
+// 5. ENC_MIN_STEP_US (current: 2000)
+//    - Detents closer together than this are EMI from the E-ink, not rotation
+//    - 8 detents/rev at a very fast 10 rev/s are still 12.5ms apart
+//
+// 6. ENC_DEBUG (current: 0)
+//    - 1 = log the counters of rejected detents from encoderPcntLogStats()
+//
+// Each detent is one interrupt: the PCNT limits are set to +/-COUNTS, so the unit
+// resets itself and raises a limit event, and the ISR pushes a timestamped
+// INPUT_EVENT_CW/CCW into the input event ring (input_events.h).
 //
 // ==================== API Functions ====================
 
-// Initialize PCNT unit for the encoder.
+// Initialize PCNT unit for the encoder and its per-detent interrupt.
+// Call from setup() on the loop core (the ISR shares the input ring's producer side).
 // - clkPin: encoder A/CLK
 // - dtPin: encoder B/DT (direction)
 void encoderPcntBegin(int clkPin, int dtPin);
 
-// Poll PCNT counter and accumulate steps into the provided accumulator.
-// - appRunning: true when UI is in normal running state; if false, rotation is discarded.
-// - stepAccum/mux: destination accumulator (same semantics as previous g_encStepAccum + g_encMux)
-void encoderPcntPoll(bool appRunning, volatile int* stepAccum, portMUX_TYPE* mux);
+// Log the detents rejected as EMI spikes or quick reversals (ENC_DEBUG only).
+void encoderPcntLogStats();
@@ -0,0 +1,45 @@
+// gestures.h
+// KidsBar: encoder gestures turned into Tamagotchi button presses.
+//
+// HOW IT WORKS:
+// - Input events (input_events.h) are read in order and placed at the emulated tick
+//   they happened (lowPowerTicksAt()). Presses last BTN_HOLD_PERIODS and the same
+//   button goes down again only BTN_GAP_PERIODS later, so bursts reach the ROM at
+//   the rate its debounce accepts. What does not fit TamaLib's queue waits in the
+//   event ring: no detent is dropped or merged.
+// - Detents are taps of C (clockwise) or A. Detents closer than GESTURE_ACCEL_MS
+//   in the same direction send several taps each, up to GESTURE_ACCEL_MAX.
+// - The encoder button is classified as a click, double click (second press within
+//   GESTURE_DOUBLE_MS), long press (held GESTURE_LONG_MS) or very long press
+//   (GESTURE_VERY_LONG_MS), each mapped to an action in config.h. Turning while
+//   the button is down sends B+C (clockwise) or A+B.
+// - A long press mapped to GESTURE_NONE holds B until the button is released.
+#pragma once
+
+#include <Arduino.h>
+
+// A button chord (bit n = Tamagotchi button n, A/B/C = BTN_LEFT/MIDDLE/RIGHT)
+// or an action for the caller.
+enum GestureAction : uint8_t {
+  GESTURE_NONE = 0,
+  GESTURE_A = 1,
+  GESTURE_B = 2,
+  GESTURE_AB = 3,
+  GESTURE_C = 4,
+  GESTURE_AC = 5,       // Sound on/off
+  GESTURE_BC = 6,
+  GESTURE_ABC = 7,
+  GESTURE_REWIND = 8,   // Go back GESTURE_REWIND_BACK emulated seconds (rewind.h)
+  GESTURE_RESET = 9,    // Erase the game and restart
+  GESTURE_SLOTS = 10,   // Save slot menu: switch game, snapshot, rename (save_slots.h)
+};
+
+// Feed pending input events to TamaLib. Call from loop() between instruction batches.
+// Returns GESTURE_REWIND / GESTURE_RESET / GESTURE_SLOTS when one was triggered, GESTURE_NONE otherwise;
+// the remaining events are handled by the next call.
+GestureAction gesturesPoll();
+
+// Forget the emulated ticks of queued presses after the emulated clock jumped
+// (call with hw_clear_inputs()), or after a menu drained the input events.
+// A press in progress is used up.
+void gesturesReset();
@@ -62,14 +62,11 @@ typedef struct {
 	timestamp_t (*get_timestamp)(void);
 
 	/* Screen related functions
-	 * NOTE: In case of direct hardware access to pixels, the set_XXXX() functions
-	 * (called for each pixel/icon update) can directly drive them, otherwise they
-	 * should just store the data in a buffer and let update_screen() do the actual
-	 * rendering (at 30 fps).
+	 * NOTE: Display memory writes are kept in the LCD model of hw.c without any
+	 * callback, update_screen() pulls the whole frame with hw_get_lcd_frame() and
+	 * does the actual rendering (at the framerate set through tamalib).
 	 */
 	void (*update_screen)(void);
-	void (*set_lcd_matrix)(u8_t x, u8_t y, bool_t val);
-	void (*set_lcd_icon)(u8_t icon, bool_t val);
 
 	/* Sound related functions
 	 * NOTE: set_frequency() changes the output frequency of the sound, while
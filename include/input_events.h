@@ -0,0 +1,59 @@
+// input_events.h
+// KidsBar: interrupt-captured button and encoder events, stamped with esp_timer time.
+//
+// HOW IT WORKS:
+// - The button has a GPIO interrupt on both edges and the encoder a PCNT limit
+//   interrupt per detent (encoder_pcnt.h). Each accepted edge goes into a lock-free
+//   single-producer / single-consumer ring with the esp_timer time it happened.
+// - Both interrupts are allocated from setup() on the loop core at the same level,
+//   so they never nest: together they are the single producer. loop() is the consumer.
+// - The button is debounced in the interrupt: an edge only counts if the level
+//   differs from the last reported one and INPUT_DEBOUNCE_US passed since then. A
+//   change hidden by that window is picked up by the consumer once the window ends.
+// - Nothing is lost while loop() blocks (E-ink refresh): events wait in the ring
+//   and the emulator applies them at the emulated time they happened.
+#pragma once
+
+#include <Arduino.h>
+
+enum InputEventType : uint8_t {
+  INPUT_EVENT_CW = 0,   // Encoder one detent clockwise
+  INPUT_EVENT_CCW,      // Encoder one detent counter-clockwise
+  INPUT_EVENT_PRESS,    // Button down
+  INPUT_EVENT_RELEASE,  // Button up
+};
+
+struct InputEvent {
+  int64_t us;  // esp_timer_get_time() of the edge
+  InputEventType type;
+};
+
+// Pending events; the producer drops (and counts) when full. Power of 2.
+static const uint32_t INPUT_EVENT_SLOTS = 64;
+
+// Contact bounce window of the encoder push button
+static const uint32_t INPUT_DEBOUNCE_US = 5000;
+
+// Attach the button interrupt (active-low pin with pull-up).
+void inputEventsBegin(int swPin);
+
+// Producer side, from an interrupt of the loop core. Returns false if the ring was full.
+bool inputEventPush(InputEventType type, int64_t us);
+
+// Consumer side (loop() only): look at the oldest event, then consume it once handled.
+bool inputEventPeek(InputEvent* ev);
+void inputEventConsume();
+
+// Drop everything pending (the press that confirmed the boot picker).
+void inputEventsClear();
+
+// Button level as last reported (true = down)
+bool inputButtonDown();
+
+// Events lost to a full ring since boot
+uint32_t inputEventsDropped();
+
+// Light sleep re-purposes the button interrupt as a level wake-up: detach it first
+// and re-attach after waking (the press that woke the chip is then reported).
+void inputEventsSuspend();
+void inputEventsResume();
@@ -0,0 +1,47 @@
+// log_ring.h
+// KidsBar: lock-free log ring buffer drained to the UART by a low-priority task,
+// so debug output never stalls the emulator loop on Serial.
+#pragma once
+
+#include <Arduino.h>
+
+enum LogLevel : uint8_t {
+  LOG_LVL_ERROR = 0,
+  LOG_LVL_WARN  = 1,
+  LOG_LVL_INFO  = 2,
+  LOG_LVL_DEBUG = 3
+};
+
+// Messages longer than this are truncated (prefix included).
+static const size_t LOG_RING_MSG_LEN = 96;
+
+// Number of pending messages; producers drop (and count) when full. Power of 2.
+static const uint32_t LOG_RING_SLOTS = 32;
+
+extern volatile uint8_t g_logLevel;
+
+// Messages above the current level are discarded before any formatting.
+static inline bool logRingEnabled(LogLevel level) { return level <= g_logLevel; }
+void logRingSetLevel(LogLevel level);
+
+// Queue a message (printf format, newline appended by the drain task).
+// Safe from any task, never blocks; returns false if the ring was full.
+bool logRingWrite(LogLevel level, const char* fmt, ...) __attribute__((format(printf, 2, 3)));
+bool logRingWriteV(LogLevel level, const char* fmt, va_list args);
+
+// Start the drain task (idempotent). Until then messages just accumulate.
+void logRingStartTask(uint8_t priority = 1, uint8_t core = 0);
+
+// Synchronously print everything pending (e.g. right before a restart).
+void logRingFlush();
+
+// Messages lost because the ring was full.
+uint32_t logRingDropped();
+
+// Lazy logging: arguments are not even evaluated when the level is disabled.
+#define KB_LOG(level, ...) \
+  do { if (logRingEnabled(level)) logRingWrite((level), __VA_ARGS__); } while (0)
+#define KB_LOGE(...) KB_LOG(LOG_LVL_ERROR, __VA_ARGS__)
+#define KB_LOGW(...) KB_LOG(LOG_LVL_WARN, __VA_ARGS__)
+#define KB_LOGI(...) KB_LOG(LOG_LVL_INFO, __VA_ARGS__)
+#define KB_LOGD(...) KB_LOG(LOG_LVL_DEBUG, __VA_ARGS__)
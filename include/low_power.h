@@ -0,0 +1,55 @@
+// low_power.h
+// KidsBar: real-time pacing, light sleep between timer interrupts, deep sleep when idle.
+//
+// HOW IT WORKS:
+// - The emulator is paced to real time from lowPowerBegin(): the loop only runs
+//   instructions while the emulated clock is behind the wall clock (plus
+//   LOW_POWER_ACTIVE_AHEAD_MS while buttons are in use).
+// - Without input for LOW_POWER_IDLE_MS, the ROM only reacts to its clock and
+//   programmable timers, so the chip light-sleeps until the next of those interrupts
+//   is due in real time (cpu_get_ticks_to_next_event(), but at least
+//   LOW_POWER_IDLE_SLICE_MS), then catches up at full speed. The encoder pins and
+//   the button wake it early.
+// - After IDLE_SLEEP_TIMEOUT_MS without input and LOW_POWER_DEEP_QUIET_MS without
+//   any LCD change, the state goes to the RTC mirror (rtc_state.h) and the chip
+//   deep-sleeps LOW_POWER_DEEP_SLEEP_S, or until the button or encoder moves. The
+//   next boot restores the mirror and emulates the time spent asleep.
+// - Going to deep sleep saves to flash only once SAVE_DIRTY_NIBBLES changed or the
+//   flash copy is older than SAVE_MAX_AGE_MS, counting the time spent asleep.
+//
+// The Tamagotchi ROM never executes HALT under this emulator (it polls its timers),
+// so idleness is judged from input and LCD activity rather than from HALT.
+#pragma once
+
+#include <Arduino.h>
+#include "savestate.h"
+
+// True if this boot is a wake from lowPowerDeepSleep() with an intact RTC mirror.
+// No flash access; call first thing in setup() (it hands the wake pins back to GPIO).
+bool lowPowerWoke();
+
+// Emulate the time spent in deep sleep, once the mirror is restored.
+// Returns false if this boot is not a wake from lowPowerDeepSleep().
+bool lowPowerResume();
+
+// Start pacing the emulator to real time from the current emulated tick.
+void lowPowerBegin();
+
+// Re-anchor the pacing after the emulated clock jumped (another save or rewind restored).
+void lowPowerResync();
+
+// Emulated tick that corresponds to an esp_timer time (an input event's timestamp).
+// Before lowPowerBegin() this is the current tick.
+u32_t lowPowerTicksAt(int64_t us);
+
+// The reverse: esp_timer time an emulated tick is due (buzzer changes).
+// Before lowPowerBegin() this is now.
+int64_t lowPowerUsAt(u32_t ticks);
+
+// Pace and sleep. Call from loop() between instruction batches.
+// Returns true when it is time for lowPowerDeepSleep().
+bool lowPowerPoll();
+
+// Save if needed, persist the snapshot to RTC memory and deep-sleep. Does not return.
+// Callers put the display to sleep first.
+void lowPowerDeepSleep(cpu_state_t* state);
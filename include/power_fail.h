@@ -0,0 +1,39 @@
+// power_fail.h
+// KidsBar: emergency save when the supply goes away.
+//
+// HOW IT WORKS:
+// - A supply-sense GPIO (POWER_SENSE_PIN) interrupts on power loss and wakes a
+//   max-priority task. The loop captures the emulator at the next instruction
+//   boundary (or the task does, if the loop is stuck in an E-ink refresh).
+// - The record holds the registers/timers plus only the RAM pages (32 bytes) that
+//   differ from the last journal save (a RAM copy of what was written), and goes
+//   into the journal's reserved, pre-erased sector with a single flash program.
+//   Buffers are static: nothing is allocated and no NVS/journal lookup happens
+//   on that path.
+// - If the loop keeps running after the record is written, it also saves to the
+//   journal (saveTriggerNow(SAVE_REASON_BROWNOUT)), so a dip the supply survives
+//   leaves a regular save behind.
+// - At boot, a record whose base is still the newest journal save is applied on
+//   top of it and appended to the journal; the sector is then erased again.
+// - The ESP32-S3 brown-out detector resets the chip from its own ISR in this core,
+//   so it cannot start the save; it is only reported from the reset reason.
+#pragma once
+
+#include <Arduino.h>
+#include "savestate.h"
+
+// Merge a pending power-fail record into the journal (the normal load then picks
+// it up). Call after initEEPROM() and before loading; returns true if merged.
+bool powerFailRecover();
+
+// Pre-erase the record sector and arm the supply-sense interrupt.
+void powerFailBegin();
+
+// Loop side: take the last saved image as the baseline and capture the state
+// when a power failure is pending. Call between instruction batches; a no-op
+// without a supply-sense pin.
+void powerFailPoll(cpu_state_t* state);
+
+// True from the power-fail interrupt until the record is written
+// (callers skip slow work such as E-ink refreshes).
+bool powerFailPending();
@@ -0,0 +1,43 @@
+// rewind.h
+// KidsBar: rewind buffer of recent emulator states.
+//
+// One snapshot (registers + packed RAM) is taken every REWIND_PERIOD_TICKS emulated
+// ticks. Every REWIND_KEYFRAME_INTERVAL-th snapshot is stored whole (keyframe), the
+// others as an XOR run-length delta against the previous snapshot, so restoring any
+// point decodes one keyframe plus at most REWIND_KEYFRAME_INTERVAL - 1 deltas.
+//
+// MEMORY:
+// - Everything lives in one arena of REWIND_ARENA_BYTES allocated once in PSRAM
+//   (REWIND_ARENA_BYTES_INTERNAL from internal RAM if the board has none), plus a
+//   fixed index of REWIND_MAX_ENTRIES entries. Nothing is allocated afterwards.
+// - When the arena or index is full the oldest keyframe group is dropped.
+#pragma once
+
+#include <Arduino.h>
+#include "savestate.h"
+
+static const uint32_t REWIND_PERIOD_TICKS = 32768;     // One snapshot per emulated second
+static const uint16_t REWIND_MAX_ENTRIES = 600;        // 10 minutes
+static const uint8_t  REWIND_KEYFRAME_INTERVAL = 30;   // Restore decodes at most 30 snapshots
+static const uint32_t REWIND_ARENA_BYTES = 128 * 1024;
+static const uint32_t REWIND_ARENA_BYTES_INTERNAL = 48 * 1024;
+
+// Allocate the arena. Returns false if no memory (rewind then stays disabled).
+bool rewindBegin();
+
+// Forget all history (after loading another save).
+void rewindReset();
+
+// Take a snapshot when the period elapsed. Call from loop() between instruction batches.
+void rewindPoll(cpu_state_t* state);
+
+// Seconds of history available (number of snapshots).
+uint16_t rewindDepth();
+
+// Restore the state from `back` snapshots ago (0 = newest). Newer history is dropped.
+// Callers refresh the hardware (cpu_refresh_hw) afterwards.
+bool rewindRestore(cpu_state_t* state, uint16_t back);
+
+// Arena bytes currently holding snapshots / arena size.
+uint32_t rewindMemoryUsed();
+uint32_t rewindMemorySize();
@@ -0,0 +1,39 @@
+// rtc_state.h
+// KidsBar: mirror of the running emulator state in RTC memory.
+//
+// - Registers, timers, interrupts and the 320-byte packed RAM (one SaveImage) are
+//   copied every RTC_MIRROR_PERIOD_TICKS emulated ticks and before deep sleep.
+// - RTC memory survives deep sleep and soft resets, so deep-sleep wakes and
+//   ESP.restart() resume from the mirror before flash is touched. Panic and
+//   watchdog resets do not: the state may be what crashed, the flash save is used.
+// - Two copies are written alternately, each with a sequence number and a CRC: a
+//   reset in the middle of a copy leaves the other one intact. After a power-on
+//   both fail the CRC and the flash save is used.
+// - The data sits in RTC_NOINIT_ATTR, the only RTC section the bootloader leaves
+//   alone on soft resets (RTC_FAST_ATTR data is reloaded).
+#pragma once
+
+#include <Arduino.h>
+#include "savestate.h"
+
+static const uint32_t RTC_MIRROR_PERIOD_TICKS = 8192;  // 4 copies per emulated second
+
+// Copy the state if the period elapsed. Call from loop() between instruction batches.
+void rtcStatePoll(cpu_state_t* state);
+
+// Copy the state now.
+void rtcStateStore(cpu_state_t* state);
+
+// True if a copy passes its CRC. No flash access.
+bool rtcStateValid();
+
+// Restore the newest intact copy. Returns false if there is none.
+// Callers refresh the hardware (cpu_refresh_hw) afterwards.
+bool rtcStateRestore(cpu_state_t* state);
+
+// Save slot of the copy rtcStateRestore() applied, -1 if none. The caller checks
+// it against the active slot once the slot index is loaded.
+int rtcStateRestoredSlot();
+
+// Forget the mirror (the game was erased: a restart must not bring it back).
+void rtcStateClear();
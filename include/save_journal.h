@@ -0,0 +1,54 @@
+// save_journal.h
+// KidsBar: append-only save-state journal on the (otherwise unused) "spiffs"
+// data partition, accessed through raw esp_partition I/O.
+//
+// LAYOUT:
+// - The partition is a circular array of fixed 512-byte records (8 per 4 KB sector),
+//   written strictly in order, so every sector wears at the same rate.
+// - Each record = 16-byte header (magic, sequence, slot, length, CRC32) + payload.
+//   A zero-length record is a tombstone: the slot has been erased.
+// - Boot recovery scans backwards from the newest record and keeps, per slot, the
+//   newest record whose CRC checks out (torn writes are skipped).
+// - The last JOURNAL_RESERVED_SECTORS sectors are left out of the ring for the
+//   power-fail record (power_fail.h).
+// - Compaction keeps the sector after the write head erased; live records found in
+//   a sector about to be erased are copied forward first. It runs on a low-priority
+//   task, so an append is a single sequential flash write with no erase.
+#pragma once
+
+#include <Arduino.h>
+#include <esp_partition.h>
+
+// Independent save slots (slot 0 = the default save).
+static const uint8_t JOURNAL_MAX_SLOTS = 8;
+
+// Largest payload a record can hold.
+static const uint16_t JOURNAL_MAX_PAYLOAD = 512 - 16;
+
+// 4 KB sectors at the end of the partition that the journal never touches.
+static const uint8_t JOURNAL_RESERVED_SECTORS = 1;
+
+// Mount the partition and recover the write head + newest record of each slot.
+// Returns false if the partition is missing (callers then fall back to NVS).
+bool saveJournalBegin();
+bool saveJournalReady();
+
+// Partition and start offset of the reserved sectors (for raw access by other modules).
+const esp_partition_t* saveJournalPartition();
+uint32_t saveJournalReservedOffset();
+
+// Append one record (single sequential write). len == 0 writes a tombstone.
+bool saveJournalAppend(uint8_t slot, const void* data, uint16_t len);
+
+// Newest valid record of a slot. Returns false if none (or tombstoned / too large).
+bool saveJournalReadLatest(uint8_t slot, void* data, uint16_t maxLen, uint16_t* lenOut = nullptr);
+bool saveJournalHasRecord(uint8_t slot);
+uint32_t saveJournalLatestSeq(uint8_t slot);  // 0 if none
+
+// Keep the sector ahead of the write head erased (copying live records forward).
+// Called by the journal task; blocks on the sector erase (~50 ms), but holds the
+// journal lock only while copying records.
+void saveJournalService();
+
+// Start the low-priority compaction task (idempotent).
+void saveJournalStartTask(uint8_t priority = 1, uint8_t core = 0);
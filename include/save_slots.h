@@ -0,0 +1,41 @@
+// save_slots.h
+// KidsBar: named save slots on top of the save journal.
+//
+// - Game slot n is journal slot n; the slot index (names + active slot) is its own
+//   journal record, with names packed 6 bits per character.
+// - Auto-saves go to the active slot (savestate's current slot).
+// - Snapshot/restore copy registers + the 320-byte packed RAM through a RAM cache,
+//   so switching the running game takes microseconds; a snapshot is then written
+//   to the journal in a single record append.
+// - UI (main.cpp): the boot picker (button held at power-on) chooses the active
+//   slot; the in-game slot menu (GESTURE_SLOTS) switches game, snapshots into a
+//   slot and renames slots.
+#pragma once
+
+#include <Arduino.h>
+#include "savestate.h"
+
+// Number of game slots offered (journal slots 0..SAVE_SLOT_COUNT-1)
+static const uint8_t SAVE_SLOT_COUNT = 4;
+
+// Longest slot name (characters A-Z, 0-9, space, '-', '.'; lower case is folded)
+static const uint8_t SAVE_SLOT_NAME_LEN = 10;
+extern const char SAVE_SLOT_NAME_CHARSET[];  // Characters a name can hold, in code order
+
+// Load the slot index and make its active slot savestate's current slot.
+void saveSlotsBegin();
+
+uint8_t saveSlotActive();
+bool saveSlotUsed(uint8_t slot);
+const char* saveSlotName(uint8_t slot);
+bool saveSlotSetName(uint8_t slot, const char* name);
+
+// Make slot the one auto-saves go to (does not touch the running game).
+bool saveSlotSetActive(uint8_t slot);
+
+// Copy the running game into slot (RAM cache + one journal append).
+bool saveSlotSnapshot(cpu_state_t* state, uint8_t slot);
+
+// Replace the running game with slot's save. Returns false if the slot is empty.
+// Callers refresh the hardware (cpu_refresh_hw) afterwards.
+bool saveSlotRestore(cpu_state_t* state, uint8_t slot);
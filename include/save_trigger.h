@@ -0,0 +1,53 @@
+// save_trigger.h
+// KidsBar: decides when the emulator state is worth saving, instead of a fixed timer.
+//
+// TRIGGERS:
+// - RAM dirtiness: enough RAM nibbles changed since the last save (SAVE_DIRTY_NIBBLES).
+// - Input: a short quiet period after the last button press (SAVE_INPUT_QUIET_MS),
+//   so a whole menu sequence costs one write.
+// - Age: a few nibbles (mostly the clock) changed and the last save is older than
+//   SAVE_MAX_AGE_MS, which bounds what a power loss can cost.
+// - Sleep / brown-out: forced synchronous save through saveTriggerNow(), before deep
+//   sleep and after a power-fail emergency record (power_fail.h).
+//
+// Dirtiness, input and age saves are rate-limited by a flash-write budget (token bucket:
+// SAVE_BUDGET_BURST writes back to back, one more every SAVE_BUDGET_REFILL_MS).
+// Forced saves always run but still spend budget.
+#pragma once
+
+#include <Arduino.h>
+
+extern "C" {
+#include "cpu.h"
+}
+
+enum SaveReason : uint8_t {
+  SAVE_REASON_DIRTY = 0,
+  SAVE_REASON_INPUT,
+  SAVE_REASON_AGE,
+  SAVE_REASON_SLEEP,
+  SAVE_REASON_BROWNOUT,
+  SAVE_REASON_COUNT
+};
+
+// Take the current RAM as the saved baseline (call after loading or resetting).
+void saveTriggerBegin(cpu_state_t* state);
+
+// Check the triggers and request a background save if one fired.
+// Cheap; call from loop() between instruction batches.
+void saveTriggerPoll();
+
+// Synchronous save regardless of budget (before sleep, on power failure).
+void saveTriggerNow(SaveReason reason);
+
+// RAM nibbles changed since the last save (or since saveTriggerBegin()).
+uint16_t saveTriggerDirtyNibbles();
+
+// Milliseconds since the last save (or since saveTriggerBegin()).
+uint32_t saveTriggerSinceSaveMs();
+
+// Saves issued per reason since boot.
+uint32_t saveTriggerCount(SaveReason reason);
+
+// Saves issued since boot, all reasons.
+uint32_t saveTriggerTotal();
@@ -0,0 +1,152 @@
+// buzzer.cpp
+// KidsBar: LEDC buzzer fed by a queue of tick-stamped tone changes (see buzzer.h).
+#include "buzzer.h"
+
+#include <atomic>
+#include <driver/ledc.h>
+#include <esp_timer.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/queue.h>
+#include <freertos/task.h>
+
+#include "config.h"
+#include "log_ring.h"
+#include "low_power.h"
+
+extern "C" {
+#include "cpu.h"
+}
+
+static const ledc_mode_t BUZZER_MODE = LEDC_LOW_SPEED_MODE;
+static const ledc_timer_t BUZZER_TIMER = LEDC_TIMER_0;
+static const ledc_channel_t BUZZER_CHANNEL = LEDC_CHANNEL_0;
+static const uint32_t BUZZER_DUTY = 1 << 9;  // 50% at 10 bits: loudest for a piezo
+static const int64_t MAX_LAG_US = BUZZER_MAX_LAG_MS * 1000LL;
+
+struct ToneChange {
+  int64_t dueUs;   // esp_timer time the emulated tick of the register write is due
+  uint16_t hz;
+  bool on;
+};
+
+static QueueHandle_t s_queue = nullptr;
+static TaskHandle_t s_taskHandle = nullptr;
+static std::atomic<uint32_t> s_dropped(0);
+static std::atomic<uint32_t> s_latest(0);   // hz << 1 | on, as last reported
+static std::atomic<bool> s_resync(false);   // A change was dropped: apply s_latest
+static std::atomic<bool> s_sounding(false);
+
+// Loop side: state as reported by the ROM
+static uint16_t s_hz = 0;
+static bool s_on = false;
+
+// Driver task side: what LEDC outputs
+static uint16_t s_outHz = 0;
+
+static void output(uint16_t hz, bool on) {
+  on = on && hz;
+  if (on && hz != s_outHz) {
+    ledc_set_freq(BUZZER_MODE, BUZZER_TIMER, hz);
+    s_outHz = hz;
+  }
+  if (on == s_sounding.load(std::memory_order_relaxed)) return;
+  ledc_set_duty(BUZZER_MODE, BUZZER_CHANNEL, on ? BUZZER_DUTY : 0);
+  ledc_update_duty(BUZZER_MODE, BUZZER_CHANNEL);
+  s_sounding.store(on, std::memory_order_relaxed);
+}
+
+static void outputLatest() {
+  uint32_t latest = s_latest.load(std::memory_order_acquire);
+  output(latest >> 1, latest & 1);
+}
+
+static void buzzerTask(void* arg) {
+  (void)arg;
+  int64_t lagUs = 0;  // How far behind the emulated schedule the tune plays
+  ToneChange change;
+
+  while (true) {
+    if (xQueueReceive(s_queue, &change, portMAX_DELAY) != pdTRUE) continue;
+
+    int64_t at = change.dueUs + lagUs;
+    int64_t now = esp_timer_get_time();
+    if (at > now) {
+      vTaskDelay(pdMS_TO_TICKS((at - now + 999) / 1000));
+    } else if (now - change.dueUs <= MAX_LAG_US) {
+      lagUs = now - change.dueUs;  // Emulation fell behind: keep the spacing from here
+    } else if (uxQueueMessagesWaiting(s_queue)) {
+      continue;  // Too late to be heard in order: only the final state matters
+    } else {
+      lagUs = 0;
+    }
+    output(change.hz, change.on);
+
+    if (uxQueueMessagesWaiting(s_queue)) continue;
+    if (!change.on) lagUs = 0;  // Silence: the next tune starts on schedule
+    if (s_resync.exchange(false)) outputLatest();
+  }
+}
+
+// Post the current state if it changed. Never waits: cpu_step() is the caller.
+static void postChange() {
+  uint32_t latest = (uint32_t)s_hz << 1 | s_on;
+  if (latest == s_latest.load(std::memory_order_relaxed)) return;
+  s_latest.store(latest, std::memory_order_release);
+  if (!s_queue) return;
+
+  ToneChange change;
+  change.dueUs = lowPowerUsAt(cpu_get_ticks());
+  change.hz = s_hz;
+  change.on = s_on;
+  if (xQueueSend(s_queue, &change, 0) != pdTRUE) {
+    // The task is busy with a full queue and resyncs once it drained it
+    s_dropped.fetch_add(1, std::memory_order_relaxed);
+    s_resync.store(true);
+  }
+}
+
+void buzzerBegin(int pin) {
+  if (pin < 0 || s_taskHandle) return;
+
+  ledc_timer_config_t timer = {};
+  timer.speed_mode = BUZZER_MODE;
+  timer.duty_resolution = LEDC_TIMER_10_BIT;
+  timer.timer_num = BUZZER_TIMER;
+  timer.freq_hz = 4096;
+  timer.clk_cfg = LEDC_AUTO_CLK;
+  ledc_channel_config_t channel = {};
+  channel.gpio_num = pin;
+  channel.speed_mode = BUZZER_MODE;
+  channel.channel = BUZZER_CHANNEL;
+  channel.intr_type = LEDC_INTR_DISABLE;
+  channel.timer_sel = BUZZER_TIMER;
+  channel.duty = 0;
+  if (ledc_timer_config(&timer) != ESP_OK || ledc_channel_config(&channel) != ESP_OK) {
+    KB_LOGE("[Buzzer] LEDC setup failed on GPIO %d", pin);
+    return;
+  }
+  s_outHz = 4096;
+  output(s_hz, s_on);  // Start from the state the ROM left
+
+  s_queue = xQueueCreate(BUZZER_QUEUE_LEN, sizeof(ToneChange));
+  if (!s_queue) return;
+  xTaskCreatePinnedToCore(buzzerTask, "buzzer", 2048, nullptr, 2, &s_taskHandle, 0);
+}
+
+void buzzerSetFrequency(u32_t hz) {
+  s_hz = (uint16_t)hz;
+  postChange();
+}
+
+void buzzerPlay(bool on) {
+  s_on = on;
+  postChange();
+}
+
+bool buzzerBusy() {
+  return s_sounding.load(std::memory_order_relaxed) || (s_queue && uxQueueMessagesWaiting(s_queue));
+}
+
+uint32_t buzzerDropped() {
+  return s_dropped.load(std::memory_order_relaxed);
+}
@@ -0,0 +1,162 @@
+/*
+ * KidsBar - Buzzer trace for the TamaLIB core
+ *
+ * The ROM rewrites the buzzer registers all the time, only state changes
+ * go into the ring. Rendering fills whole runs of samples between two
+ * changes, so long runs render much faster than real time.
+ */
+#include <stdio.h>
+#include <string.h>
+
+#include "buzzer_trace.h"
+#include "cpu.h"
+
+#define WAV_SILENCE		0x80
+#define WAV_LOW			0x40
+#define WAV_HIGH		0xC0
+#define WAV_CHUNK		256
+
+static buzzer_change_t changes[BUZZER_TRACE_DEPTH];
+static u32_t head = 0; // Index of the next change to write (free running)
+static u32_t tail = 0; // Index of the next change to read (free running)
+static u32_t dropped = 0;
+
+static uint16_t cur_freq = 0;
+static bool_t cur_on = 0;
+
+
+static void record(uint16_t freq, bool_t on)
+{
+	buzzer_change_t *c;
+
+	if (freq == cur_freq && on == cur_on) {
+		return;
+	}
+	cur_freq = freq;
+	cur_on = on;
+
+	/* Keep the newest changes */
+	if (head - tail == BUZZER_TRACE_DEPTH) {
+		tail++;
+		dropped++;
+	}
+
+	c = &changes[head & (BUZZER_TRACE_DEPTH - 1)];
+	c->ts = cpu_get_ticks();
+	c->freq = freq;
+	c->on = on;
+	head++;
+}
+
+void buzzer_trace_reset(void)
+{
+	head = 0;
+	tail = 0;
+	dropped = 0;
+	cur_freq = 0;
+	cur_on = 0;
+}
+
+void buzzer_trace_set_frequency(u32_t freq)
+{
+	record((uint16_t) freq, cur_on);
+}
+
+void buzzer_trace_play(bool_t en)
+{
+	record(cur_freq, !!en);
+}
+
+u32_t buzzer_trace_read(buzzer_change_t *out, u32_t max)
+{
+	u32_t n = 0;
+
+	while (n < max && tail != head) {
+		out[n++] = changes[tail++ & (BUZZER_TRACE_DEPTH - 1)];
+	}
+
+	return n;
+}
+
+u32_t buzzer_trace_dropped(void)
+{
+	return dropped;
+}
+
+int buzzer_trace_format(const buzzer_change_t *c, char *buf, size_t len)
+{
+	return snprintf(buf, len, "%lu %u %u\n", (unsigned long) c->ts, c->freq, c->on);
+}
+
+static void put_le(u8_t *p, u32_t v, u8_t bytes)
+{
+	while (bytes--) {
+		*p++ = v & 0xFF;
+		v >>= 8;
+	}
+}
+
+void buzzer_wav_header(u8_t header[BUZZER_WAV_HEADER_SIZE], u32_t rate, u32_t samples)
+{
+	memcpy(header, "RIFF\0\0\0\0WAVEfmt ", 16);
+	put_le(header + 4, 36 + samples, 4);
+	put_le(header + 16, 16, 4); // fmt chunk size
+	put_le(header + 20, 1, 2); // PCM
+	put_le(header + 22, 1, 2); // Mono
+	put_le(header + 24, rate, 4);
+	put_le(header + 28, rate, 4); // Bytes per second
+	put_le(header + 32, 1, 2); // Block align
+	put_le(header + 34, 8, 2); // Bits per sample
+	memcpy(header + 36, "data", 4);
+	put_le(header + 40, samples, 4);
+}
+
+void buzzer_wav_begin(buzzer_wav_t *w, u32_t rate, u32_t start_ts, buzzer_wav_write_t write, void *ctx)
+{
+	memset(w, 0, sizeof(*w));
+	w->rate = rate;
+	w->start_ts = start_ts;
+	w->write = write;
+	w->ctx = ctx;
+}
+
+void buzzer_wav_render_until(buzzer_wav_t *w, u32_t ts)
+{
+	u8_t buf[WAV_CHUNK];
+	u32_t target = (u32_t) ((uint64_t) (ts - w->start_ts) * w->rate / TICK_FREQUENCY);
+	u32_t step = (u32_t) (((uint64_t) w->freq << 32) / w->rate);
+	u32_t n, i;
+
+	while ((int32_t) (target - w->samples) > 0) {
+		n = target - w->samples;
+		if (n > WAV_CHUNK) {
+			n = WAV_CHUNK;
+		}
+
+		if (w->on && w->freq != 0) {
+			for (i = 0; i < n; i++) {
+				buf[i] = (w->phase & 0x80000000) ? WAV_HIGH : WAV_LOW;
+				w->phase += step;
+			}
+		} else {
+			memset(buf, WAV_SILENCE, n);
+		}
+
+		w->write(buf, n, w->ctx);
+		w->samples += n;
+	}
+}
+
+void buzzer_wav_render(buzzer_wav_t *w, const buzzer_change_t *c, u32_t count)
+{
+	for (; count != 0; count--, c++) {
+		buzzer_wav_render_until(w, c->ts);
+
+		/* Each tone starts on a fresh period, like the buzzer output */
+		if (c->on && !w->on) {
+			w->phase = 0;
+		}
+		w->freq = c->freq;
+		w->on = c->on;
+	}
+}
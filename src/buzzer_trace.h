@@ -0,0 +1,72 @@
+/*
+ * KidsBar - Buzzer trace for the TamaLIB core
+ *
+ * Records the tone changes a HAL receives (set_frequency / play_frequency)
+ * with their emulated timestamp, so that the sound of a run can be checked
+ * without a speaker: as diffable text lines, or rendered to a WAV file.
+ * Plain C with no platform dependency, for the firmware and host harnesses.
+ */
+#ifndef _BUZZER_TRACE_H_
+#define _BUZZER_TRACE_H_
+
+#include <stddef.h>
+
+#include "hal.h"
+
+#define BUZZER_TRACE_DEPTH		256 // Changes kept until read, must be a power of 2
+#define BUZZER_WAV_HEADER_SIZE		44
+
+typedef struct {
+	u32_t ts; // Emulated ticks
+	uint16_t freq; // Hz
+	bool_t on;
+} buzzer_change_t;
+
+/* Sink for rendered WAV bytes */
+typedef void (*buzzer_wav_write_t)(const u8_t *data, u32_t len, void *ctx);
+
+typedef struct {
+	u32_t rate; // Samples per second
+	u32_t start_ts; // Emulated ticks at sample 0
+	u32_t samples; // Written so far
+	u32_t phase; // Square wave phase, a full period is 2^32
+	uint16_t freq;
+	bool_t on;
+	buzzer_wav_write_t write;
+	void *ctx;
+} buzzer_wav_t;
+
+#ifdef __cplusplus
+ extern "C" {
+#endif
+
+void buzzer_trace_reset(void);
+
+/* Call from the HAL hooks; only actual changes are recorded */
+void buzzer_trace_set_frequency(u32_t freq);
+void buzzer_trace_play(bool_t en);
+
+/* Move up to max recorded changes to out, oldest first. Returns how many */
+u32_t buzzer_trace_read(buzzer_change_t *out, u32_t max);
+
+/* Changes overwritten before being read */
+u32_t buzzer_trace_dropped(void);
+
+/* One "<ticks> <freq> <on>" line, as snprintf() */
+int buzzer_trace_format(const buzzer_change_t *c, char *buf, size_t len);
+
+/* 8-bit mono PCM header for a file of the given number of samples */
+void buzzer_wav_header(u8_t header[BUZZER_WAV_HEADER_SIZE], u32_t rate, u32_t samples);
+
+/* Render changes as a square wave from start_ts on (the header is up to the caller) */
+void buzzer_wav_begin(buzzer_wav_t *w, u32_t rate, u32_t start_ts, buzzer_wav_write_t write, void *ctx);
+void buzzer_wav_render(buzzer_wav_t *w, const buzzer_change_t *changes, u32_t count);
+
+/* Render the current tone up to ts */
+void buzzer_wav_render_until(buzzer_wav_t *w, u32_t ts);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _BUZZER_TRACE_H_ */
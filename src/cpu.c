@@ -28,10 +28,12 @@
 #include "rom_12bit.h"
 
 #define CPU_SPEED_RATIO      0
-#define TICK_FREQUENCY        32768 // Hz
 
-#define TIMER_1HZ_PERIOD      32768 // in ticks
-#define TIMER_256HZ_PERIOD      128 // in ticks
+#define SW_TIMER_TICKS(n)     ((n) * TIMER_1HZ_PERIOD / 100) // 1/100 s counts since the second started
+#define WATCHDOG_PERIOD       (4 * TIMER_1HZ_PERIOD) // in ticks (3 to 4 s on the hardware)
+#define WATCHDOG_RESET        0 // 1 = an overflow resets the CPU like the hardware, 0 = only log it
+
+#define ROM_WORDS       (sizeof(g_program_b12) * 2 / 3) // 12-bit words, 2 per 3 bytes
 
 #define MASK_4B         0xF00
 #define MASK_6B         0xFC0
@@ -99,6 +101,8 @@
 #define REG_PROG_TIMER_DATA_H     0xF25
 #define REG_PROG_TIMER_RELOAD_DATA_L    0xF26
 #define REG_PROG_TIMER_RELOAD_DATA_H    0xF27
+#define REG_SW_TIMER_DATA_L     0xF62
+#define REG_SW_TIMER_DATA_H     0xF63
 #define REG_K00_K03_INPUT_PORT      0xF40
 #define REG_K10_K13_INPUT_PORT      0xF42
 #define REG_K40_K43_BZ_OUTPUT_PORT    0xF54
@@ -151,7 +155,22 @@ static u4_t flags;
 
 //static const u12_t *g_program = NULL;
 static u4_t memory[MEMORY_SIZE];
-//static u4_t io_memory[MEM_IO_SIZE];
+
+/* Packed RAM: two nibbles per byte, the even address in the high nibble */
+#define RAM_SHIFT(n)      ((~(n) & 0x1) << 2)
+
+#ifdef CPU_UNPACKED_RAM
+/* One nibble per byte, memory[] is only the packed image for cpu_get/set_state() */
+static u4_t ram[MEM_RAM_SIZE];
+
+#define RAM_GET(n)        ram[n]
+#define RAM_SET(n, v)     ram[n] = (v)
+#else
+#define RAM_GET(n)        ((memory[(n) >> 1] >> RAM_SHIFT(n)) & 0xF)
+#define RAM_SET(n, v)     memory[(n) >> 1] = (memory[(n) >> 1] & ~(0xF << RAM_SHIFT(n))) | ((v) << RAM_SHIFT(n))
+#endif
+
+static u4_t io_memory[MEM_IO_SIZE]; /* Plain registers (no side effect), by offset */
 
 static input_port_t inputs[INPUT_PORT_NUM] = {{0}};
 
@@ -167,6 +186,9 @@ static interrupt_t interrupts[INT_SLOT_NUM] = {
   {0x0, 0x0, 0, 0x02}, // Clock timer
 };
 
+/* Bit n set = interrupts[n] triggered; the lowest bit has the highest priority */
+static u8_t int_pending = 0;
+
 //static breakpoint_t *g_breakpoints = NULL;
 
 static u32_t call_depth = 0;
@@ -177,6 +199,19 @@ static bool_t prog_timer_enabled = 0;
 static u8_t prog_timer_data = 0;
 static u8_t prog_timer_rld = 0;
 
+static bool_t sw_timer_enabled = 0;
+static u8_t sw_timer_data = 0; // 1/100 s since the last second (SWH:SWL in BCD)
+static u32_t sw_timer_timestamp = 0; // in ticks, start of the current second
+
+static u32_t wd_timer_timestamp = 0; // in ticks, last watchdog reset
+
+static u32_t timer_due = 0; // in ticks, when the earliest timer needs processing
+
+/* Prog timer input clock period for each REG_PROG_TIMER_CLK_SEL value (0 = K03 input, not emulated) */
+static const u32_t prog_timer_periods[8] = {0, 0, TIMER_256HZ_PERIOD, 64, 32, 16, 8, 4};
+
+static void update_timer_due(void);
+
 static u32_t tick_counter = 0;
 static u32_t ts_freq;
 //static u8_t speed_ratio = 0;
@@ -248,6 +283,8 @@ void cpu_set_speed(u8_t speed)
 
 void cpu_get_state(cpu_state_t *cpustate)
 {
+  u12_t i;
+
   cpustate->pc = pc;
   cpustate->x = x;
   cpustate->y = y;
@@ -264,12 +301,16 @@ void cpu_get_state(cpu_state_t *cpustate)
   cpustate->prog_timer_data = prog_timer_data;
   cpustate->prog_timer_rld = prog_timer_rld;
   cpustate->call_depth = call_depth;
+#ifdef CPU_UNPACKED_RAM
+  for (i = 0; i < MEM_RAM_SIZE; i += 2) {
+    memory[i >> 1] = (ram[i] << 4) | ram[i + 1];
+  }
+#endif
   cpustate->memory = (u4_t *)memory;
-  uint8_t i;
   for(i=0;i<6;i++) {
     cpustate->interrupts[i].factor_flag_reg = interrupts[i].factor_flag_reg;
     cpustate->interrupts[i].mask_reg = interrupts[i].mask_reg;
-    cpustate->interrupts[i].triggered = interrupts[i].triggered;
+    cpustate->interrupts[i].triggered = (int_pending >> i) & 0x1;
     cpustate->interrupts[i].vector = interrupts[i].vector;
   }
 }
@@ -292,13 +333,52 @@ void cpu_set_state(cpu_state_t *cpustate)
   prog_timer_rld = cpustate->prog_timer_rld;
   call_depth = cpustate->call_depth;
   //memory = (u4_t *)cpustate->memory;
-  uint8_t i;
+  u12_t i;
+#ifdef CPU_UNPACKED_RAM
+  for (i = 0; i < MEM_RAM_SIZE; i++) {
+    ram[i] = (memory[i >> 1] >> RAM_SHIFT(i)) & 0xF;
+  }
+#endif
+  int_pending = 0;
   for(i=0;i<6;i++) {
     interrupts[i].factor_flag_reg = cpustate->interrupts[i].factor_flag_reg;
     interrupts[i].mask_reg = cpustate->interrupts[i].mask_reg;
-    interrupts[i].triggered = cpustate->interrupts[i].triggered;
+    int_pending |= (!!cpustate->interrupts[i].triggered) << i;
     interrupts[i].vector = cpustate->interrupts[i].vector;
   }
+
+  /* The watchdog is not saved: a restored game gets a full period */
+  wd_timer_timestamp = tick_counter;
+  update_timer_due();
+}
+
+bool_t cpu_check_state(const cpu_state_t *cpustate)
+{
+  u8_t i;
+
+  /* Registers wider than the hardware ones, or a PC outside the ROM */
+  if (cpustate->pc >= ROM_WORDS || cpustate->np > 0x1F || cpustate->x > 0xFFF || cpustate->y > 0xFFF ||
+      cpustate->a > 0xF || cpustate->b > 0xF || cpustate->flags > 0xF) {
+    return 0;
+  }
+
+  /* Between two instructions the timers are less than a period behind (plus the
+   * cycles of an interrupt call): two periods is already garbage */
+  if (cpustate->tick_counter - cpustate->clk_timer_timestamp >= 2 * TIMER_1HZ_PERIOD ||
+      cpustate->prog_timer_enabled > 1 ||
+      (cpustate->prog_timer_enabled && cpustate->tick_counter - cpustate->prog_timer_timestamp >= 2 * TIMER_256HZ_PERIOD)) {
+    return 0;
+  }
+
+  /* The vectors are constants: a mismatch means another layout */
+  for (i = 0; i < INT_SLOT_NUM; i++) {
+    if (cpustate->interrupts[i].factor_flag_reg > 0xF || cpustate->interrupts[i].mask_reg > 0xF ||
+        cpustate->interrupts[i].triggered > 1 || cpustate->interrupts[i].vector != interrupts[i].vector) {
+      return 0;
+    }
+  }
+
+  return 1;
 }
 
 u32_t cpu_get_depth(void)
@@ -306,6 +386,34 @@ u32_t cpu_get_depth(void)
   return call_depth;
 }
 
+u32_t cpu_get_ticks(void)
+{
+  return tick_counter;
+}
+
+static u32_t prog_timer_period(void)
+{
+  return prog_timer_periods[io_memory[REG_PROG_TIMER_CLK_SEL - MEM_IO_ADDR] & 0x7];
+}
+
+u32_t cpu_get_ticks_to_next_event(void)
+{
+  u32_t next = TIMER_1HZ_PERIOD - (tick_counter - clk_timer_timestamp);
+  u32_t period = prog_timer_period();
+  u32_t prog;
+
+  if (prog_timer_enabled && period != 0) {
+    /* The interrupt comes when the counter reaches 0 (a 0 counter first wraps to 255) */
+    prog = (prog_timer_data != 0) ? prog_timer_data : 256;
+    prog = prog * period - (tick_counter - prog_timer_timestamp);
+    if (prog < next) {
+      next = prog;
+    }
+  }
+
+  return next;
+}
+
 static void generate_interrupt(int_slot_t slot, u8_t bit)
 {
   /* Set the factor flag no matter what */
@@ -313,8 +421,92 @@ static void generate_interrupt(int_slot_t slot, u8_t bit)
 
   /* Trigger the INT only if not masked */
   if (interrupts[slot].mask_reg & (0x1 << bit)) {
-    interrupts[slot].triggered = 1;
+    int_pending |= 0x1 << slot;
+  }
+}
+
+/* Ticks until a timer is due, negative if it is late */
+static int32_t timer_distance(u32_t due)
+{
+  return (int32_t)(due - tick_counter);
+}
+
+static void update_timer_due(void)
+{
+  u32_t period = prog_timer_period();
+  int32_t next = timer_distance(clk_timer_timestamp + TIMER_1HZ_PERIOD);
+  int32_t d;
+
+  if (prog_timer_enabled && period != 0) {
+    d = timer_distance(prog_timer_timestamp + period);
+    if (d < next) next = d;
+  }
+
+  if (sw_timer_enabled) {
+    d = timer_distance(sw_timer_timestamp + SW_TIMER_TICKS(sw_timer_data + 1));
+    if (d < next) next = d;
   }
+
+  d = timer_distance(wd_timer_timestamp + WATCHDOG_PERIOD);
+  if (d < next) next = d;
+
+  timer_due = tick_counter + next;
+}
+
+/* Advance every timer that is due, then schedule the next check */
+static void process_timers(void)
+{
+  u32_t period;
+
+  if (tick_counter - clk_timer_timestamp >= TIMER_1HZ_PERIOD) {
+    do {
+      clk_timer_timestamp += TIMER_1HZ_PERIOD;
+    } while (tick_counter - clk_timer_timestamp >= TIMER_1HZ_PERIOD);
+
+    generate_interrupt(INT_CLOCK_TIMER_SLOT, 3);
+  }
+
+  period = prog_timer_period();
+  if (prog_timer_enabled && period != 0 && tick_counter - prog_timer_timestamp >= period) {
+    do {
+      prog_timer_timestamp += period;
+      prog_timer_data--;
+
+      if (prog_timer_data == 0) {
+        prog_timer_data = prog_timer_rld;
+        generate_interrupt(INT_PROG_TIMER_SLOT, 0);
+      }
+    } while (tick_counter - prog_timer_timestamp >= period);
+  }
+
+  if (sw_timer_enabled && tick_counter - sw_timer_timestamp >= SW_TIMER_TICKS(sw_timer_data + 1)) {
+    do {
+      sw_timer_data++;
+
+      if (sw_timer_data == 100) {
+        /* SWH overflow (1 Hz) */
+        sw_timer_data = 0;
+        sw_timer_timestamp += TIMER_1HZ_PERIOD;
+        generate_interrupt(INT_STOPWATCH_SLOT, 1);
+      }
+
+      if (sw_timer_data % 10 == 0) {
+        /* SWL overflow (10 Hz) */
+        generate_interrupt(INT_STOPWATCH_SLOT, 0);
+      }
+    } while (tick_counter - sw_timer_timestamp >= SW_TIMER_TICKS(sw_timer_data + 1));
+  }
+
+  if (tick_counter - wd_timer_timestamp >= WATCHDOG_PERIOD) {
+    /* The ROM stopped resetting the watchdog */
+    g_hal->log(LOG_ERROR, "Watchdog overflow - PC = 0x%04X\n", pc);
+    wd_timer_timestamp = tick_counter;
+    if (WATCHDOG_RESET) {
+      cpu_reset();
+    }
+  }
+
+  update_timer_due();
 }
 
 void cpu_set_input_pin(pin_t pin, pin_state_t state)
@@ -341,278 +533,223 @@ void cpu_sync_ref_timestamp(void)
   ref_ts = g_hal->get_timestamp();
 }
 
-static u4_t get_io(u12_t n)
-{
-  u4_t tmp;
+/* Interrupt slot of each factor flag (0xF00-0xF05) and mask (0xF10-0xF15) register */
+static const int_slot_t io_int_slots[INT_SLOT_NUM] = {
+  INT_CLOCK_TIMER_SLOT,
+  INT_STOPWATCH_SLOT,
+  INT_PROG_TIMER_SLOT,
+  INT_SERIAL_SLOT,
+  INT_K00_K03_SLOT,
+  INT_K10_K13_SLOT,
+};
 
-  switch (n) {
-    case REG_CLK_INT_FACTOR_FLAGS:
-      /* Interrupt factor flags (clock timer) */
-      tmp = interrupts[INT_CLOCK_TIMER_SLOT].factor_flag_reg;
-      interrupts[INT_CLOCK_TIMER_SLOT].factor_flag_reg = 0;
-      return tmp;
-
-    case REG_SW_INT_FACTOR_FLAGS:
-      /* Interrupt factor flags (stopwatch) */
-      tmp = interrupts[INT_STOPWATCH_SLOT].factor_flag_reg;
-      interrupts[INT_STOPWATCH_SLOT].factor_flag_reg = 0;
-      return tmp;
-
-    case REG_PROG_INT_FACTOR_FLAGS:
-      /* Interrupt factor flags (prog timer) */
-      tmp = interrupts[INT_PROG_TIMER_SLOT].factor_flag_reg;
-      interrupts[INT_PROG_TIMER_SLOT].factor_flag_reg = 0;
-      return tmp;
-
-    case REG_SERIAL_INT_FACTOR_FLAGS:
-      /* Interrupt factor flags (serial) */
-      tmp = interrupts[INT_SERIAL_SLOT].factor_flag_reg;
-      interrupts[INT_SERIAL_SLOT].factor_flag_reg = 0;
-      return tmp;
-
-    case REG_K00_K03_INT_FACTOR_FLAGS:
-      /* Interrupt factor flags (K00-K03) */
-      tmp = interrupts[INT_K00_K03_SLOT].factor_flag_reg;
-      interrupts[INT_K00_K03_SLOT].factor_flag_reg = 0;
-      return tmp;
-
-    case REG_K10_K13_INT_FACTOR_FLAGS:
-      /* Interrupt factor flags (K10-K13) */
-      tmp = interrupts[INT_K10_K13_SLOT].factor_flag_reg;
-      interrupts[INT_K10_K13_SLOT].factor_flag_reg = 0;
-      return tmp;
-
-    case REG_CLOCK_INT_MASKS:
-      /* Clock timer interrupt masks */
-      return interrupts[INT_CLOCK_TIMER_SLOT].mask_reg;
-
-    case REG_SW_INT_MASKS:
-      /* Stopwatch interrupt masks */
-      return interrupts[INT_STOPWATCH_SLOT].mask_reg & 0x3;
-
-    case REG_PROG_INT_MASKS:
-      /* Prog timer interrupt masks */
-      return interrupts[INT_PROG_TIMER_SLOT].mask_reg & 0x1;
-
-    case REG_SERIAL_INT_MASKS:
-      /* Serial interface interrupt masks */
-      return interrupts[INT_SERIAL_SLOT].mask_reg & 0x1;
-
-    case REG_K00_K03_INT_MASKS:
-      /* Input (K00-K03) interrupt masks */
-      return interrupts[INT_K00_K03_SLOT].mask_reg;
-
-    case REG_K10_K13_INT_MASKS:
-      /* Input (K10-K13) interrupt masks */
-      return interrupts[INT_K10_K13_SLOT].mask_reg;
-
-    case REG_PROG_TIMER_DATA_L:
-      /* Prog timer data (low) */
-      return prog_timer_data & 0xF;
-
-    case REG_PROG_TIMER_DATA_H:
-      /* Prog timer data (high) */
-      return (prog_timer_data >> 4) & 0xF;
-
-    case REG_PROG_TIMER_RELOAD_DATA_L:
-      /* Prog timer reload data (low) */
-      return prog_timer_rld & 0xF;
-
-    case REG_PROG_TIMER_RELOAD_DATA_H:
-      /* Prog timer reload data (high) */
-      return (prog_timer_rld >> 4) & 0xF;
-
-    case REG_K00_K03_INPUT_PORT:
-      /* Input port (K00-K03) */
-      return inputs[0].states;
-
-    case REG_K10_K13_INPUT_PORT:
-      /* Input port (K10-K13) */
-      return inputs[1].states;
-
-    case REG_K40_K43_BZ_OUTPUT_PORT:
-      /* Output port (R40-R43) */
-      //return io_memory[n - MEM_IO_ADDR_OFS];
-      return 0xf;
-    case REG_CPU_OSC3_CTRL:
-      /* CPU/OSC3 clocks switch, CPU voltage switch */
-      //return io_memory[n - MEM_IO_ADDR_OFS];
-      return 0;
-    case REG_LCD_CTRL:
-      /* LCD control */
-      //return io_memory[n - MEM_IO_ADDR_OFS];
-      return 0x8;
-    case REG_LCD_CONTRAST:
-      /* LCD contrast */
-      break;
+/* Implemented mask bits, same order */
+static const u4_t io_int_mask_bits[INT_SLOT_NUM] = {0xF, 0x3, 0x1, 0x1, 0xF, 0xF};
 
-    case REG_SVD_CTRL:
-      /* SVD */
-      //return io_memory[n - MEM_IO_ADDR_OFS] & 0x7; // Voltage always OK
-      return 0;
-    case REG_BUZZER_CTRL1:
-      /* Buzzer config 1 */
-      //return memory[n - MEM_IO_ADDR_OFS];
-      return 0;
-    case REG_BUZZER_CTRL2:
-      /* Buzzer config 2 */
-      //return io_memory[n - MEM_IO_ADDR_OFS] & 0x3; // Buzzer ready
-      return 0;
-    case REG_CLK_WD_TIMER_CTRL:
-      /* Clock/Watchdog timer reset */
-      break;
+static u4_t io_get_int_factor(u12_t n)
+{
+  /* Reading the factor flags clears them */
+  interrupt_t *irq = &interrupts[io_int_slots[n & 0xF]];
+  u4_t tmp = irq->factor_flag_reg;
 
-    case REG_SW_TIMER_CTRL:
-      /* Stopwatch stop/run/reset */
-      break;
+  irq->factor_flag_reg = 0;
+  return tmp;
+}
 
-    case REG_PROG_TIMER_CTRL:
-      /* Prog timer stop/run/reset */
-      return !!prog_timer_enabled;
+static u4_t io_get_int_mask(u12_t n)
+{
+  return interrupts[io_int_slots[n & 0xF]].mask_reg;
+}
 
-    case REG_PROG_TIMER_CLK_SEL:
-      /* Prog timer clock selection */
-      break;
+static void io_set_int_mask(u12_t n, u4_t v)
+{
+  interrupts[io_int_slots[n & 0xF]].mask_reg = v & io_int_mask_bits[n & 0xF];
+}
 
-    default:
-      break;
-      //g_hal->log(LOG_ERROR,   "Read from unimplemented I/O 0x%03X - PC = 0x%04X\n", n, pc);
+static u4_t io_get_prog_timer(u12_t n)
+{
+  switch (n) {
+    case REG_PROG_TIMER_DATA_L: return prog_timer_data & 0xF;
+    case REG_PROG_TIMER_DATA_H: return (prog_timer_data >> 4) & 0xF;
+    case REG_PROG_TIMER_RELOAD_DATA_L: return prog_timer_rld & 0xF;
+    case REG_PROG_TIMER_RELOAD_DATA_H: return (prog_timer_rld >> 4) & 0xF;
   }
-
   return 0;
 }
 
-static void set_io(u12_t n, u4_t v)
+static void io_set_prog_timer_rld(u12_t n, u4_t v)
 {
-  switch (n) {
-    case REG_CLOCK_INT_MASKS:
-      /* Clock timer interrupt masks */
-      /* Assume 1Hz timer INT enabled (0x8) */
-      interrupts[INT_CLOCK_TIMER_SLOT].mask_reg = v;
-      break;
+  if (n == REG_PROG_TIMER_RELOAD_DATA_L) {
+    prog_timer_rld = v | (prog_timer_rld & 0xF0);
+  } else {
+    prog_timer_rld = (prog_timer_rld & 0xF) | (v << 4);
+  }
+}
 
-    case REG_SW_INT_MASKS:
-      /* Stopwatch interrupt masks */
-      /* Assume all INT disabled */
-      interrupts[INT_STOPWATCH_SLOT].mask_reg = v;
-      break;
+static u4_t io_get_prog_timer_ctrl(u12_t n)
+{
+  return !!prog_timer_enabled;
+}
 
-    case REG_PROG_INT_MASKS:
-      /* Prog timer interrupt masks */
-      /* Assume Prog timer INT enabled (0x1) */
-      interrupts[INT_PROG_TIMER_SLOT].mask_reg = v;
-      break;
+static void io_set_prog_timer_ctrl(u12_t n, u4_t v)
+{
+  /* Reset */
+  if (v & 0x2) {
+    prog_timer_data = prog_timer_rld;
+  }
 
-    case REG_SERIAL_INT_MASKS:
-      /* Serial interface interrupt masks */
-      /* Assume all INT disabled */
-      interrupts[INT_K10_K13_SLOT].mask_reg = v;
-      break;
+  /* Run/stop */
+  if ((v & 0x1) && !prog_timer_enabled) {
+    prog_timer_timestamp = tick_counter;
+  }
 
-    case REG_K00_K03_INT_MASKS:
-      /* Input (K00-K03) interrupt masks */
-      /* Assume all INT disabled */
-      interrupts[INT_SERIAL_SLOT].mask_reg = v;
-      break;
+  prog_timer_enabled = v & 0x1;
+  update_timer_due();
+}
 
-    case REG_K10_K13_INT_MASKS:
-      /* Input (K10-K13) interrupt masks */
-      /* Assume all INT disabled */
-      interrupts[INT_K10_K13_SLOT].mask_reg = v;
-      break;
+static void io_set_prog_timer_clk_sel(u12_t n, u4_t v)
+{
+  io_memory[n - MEM_IO_ADDR] = v;
+  update_timer_due();
+}
 
-    case REG_PROG_TIMER_RELOAD_DATA_L:
-      /* Prog timer reload data (low) */
-      prog_timer_rld = v | (prog_timer_rld & 0xF0);
-      break;
+static u4_t io_get_sw_timer(u12_t n)
+{
+  /* BCD: 1/100 s (SWL), then 1/10 s (SWH) */
+  return (n == REG_SW_TIMER_DATA_L) ? sw_timer_data % 10 : sw_timer_data / 10;
+}
 
-    case REG_PROG_TIMER_RELOAD_DATA_H:
-      /* Prog timer reload data (high) */
-      prog_timer_rld = (prog_timer_rld & 0xF) | (v << 4);
-      break;
+static u4_t io_get_sw_timer_ctrl(u12_t n)
+{
+  return !!sw_timer_enabled;
+}
 
-    case REG_K00_K03_INPUT_PORT:
-      /* Input port (K00-K03) */
-      /* Write not allowed */
-      break;
+static void io_set_sw_timer_ctrl(u12_t n, u4_t v)
+{
+  /* Reset */
+  if (v & 0x2) {
+    sw_timer_data = 0;
+    sw_timer_timestamp = tick_counter;
+  }
 
-    case REG_K40_K43_BZ_OUTPUT_PORT:
-      /* Output port (R40-R43) */
-      //g_hal->log(LOG_INFO, "Output/Buzzer: 0x%X\n", v);
-      hw_enable_buzzer(!(v & 0x8));
-      break;
+  /* Run/stop: resume where the count stopped within the second */
+  if ((v & 0x1) && !sw_timer_enabled) {
+    sw_timer_timestamp = tick_counter - sw_timer_data * TIMER_1HZ_PERIOD / 100;
+  }
 
-    case REG_CPU_OSC3_CTRL:
-      /* CPU/OSC3 clocks switch, CPU voltage switch */
-      /* Assume 32,768 OSC1 selected, OSC3 off, battery >= 3,1V (0x1) */
-      break;
+  sw_timer_enabled = v & 0x1;
+  update_timer_due();
+}
 
-    case REG_LCD_CTRL:
-      /* LCD control */
-      break;
+static void io_set_clk_wd_timer_ctrl(u12_t n, u4_t v)
+{
+  /* Watchdog reset */
+  if (v & 0x1) {
+    wd_timer_timestamp = tick_counter;
+  }
 
-    case REG_LCD_CONTRAST:
-      /* LCD contrast */
-      /* Assume medium contrast (0x8) */
-      break;
+  /* Clock timer reset: the next 1 Hz interrupt is a full second away */
+  if (v & 0x2) {
+    clk_timer_timestamp = tick_counter;
+  }
 
-    case REG_SVD_CTRL:
-      /* SVD */
-      /* Assume battery voltage always OK (0x6) */
-      break;
+  update_timer_due();
+}
 
-    case REG_BUZZER_CTRL1:
-      /* Buzzer config 1 */
-      hw_set_buzzer_freq(v & 0x7);
-      break;
+static u4_t io_get_input_port(u12_t n)
+{
+  return inputs[(n == REG_K10_K13_INPUT_PORT) ? 1 : 0].states;
+}
 
-    case REG_BUZZER_CTRL2:
-      /* Buzzer config 2 */
-      break;
+static u4_t io_get_plain(u12_t n)
+{
+  return io_memory[n - MEM_IO_ADDR];
+}
 
-    case REG_CLK_WD_TIMER_CTRL:
-      /* Clock/Watchdog timer reset */
-      /* Ignore watchdog */
-      break;
+static void io_set_plain(u12_t n, u4_t v)
+{
+  io_memory[n - MEM_IO_ADDR] = v;
+}
 
-    case REG_SW_TIMER_CTRL:
-      /* Stopwatch stop/run/reset */
-      break;
+static u4_t io_get_svd(u12_t n)
+{
+  /* Battery voltage always OK */
+  return io_memory[n - MEM_IO_ADDR] & 0x7;
+}
 
-    case REG_PROG_TIMER_CTRL:
-      /* Prog timer stop/run/reset */
-      if (v & 0x2) {
-        prog_timer_data = prog_timer_rld;
-      }
+static u4_t io_get_buzzer_ctrl2(u12_t n)
+{
+  /* One-shot buzzer always done */
+  return io_memory[n - MEM_IO_ADDR] & 0x3;
+}
 
-      if ((v & 0x1) && !prog_timer_enabled) {
-        prog_timer_timestamp = tick_counter;
-      }
+static void io_set_bz_output_port(u12_t n, u4_t v)
+{
+  io_memory[n - MEM_IO_ADDR] = v;
+  hw_enable_buzzer(!(v & 0x8));
+}
 
-      prog_timer_enabled = v & 0x1;
-      break;
+static void io_set_buzzer_ctrl1(u12_t n, u4_t v)
+{
+  io_memory[n - MEM_IO_ADDR] = v;
+  hw_set_buzzer_freq(v & 0x7);
+}
 
-    case REG_PROG_TIMER_CLK_SEL:
-      /* Prog timer clock selection */
-      /* Assume 256Hz, output disabled */
-      break;
+typedef struct {
+  u4_t (*get)(u12_t n);
+  void (*set)(u12_t n, u4_t v);
+} io_reg_t;
+
+#define IO_REG(n)         [(n) - MEM_IO_ADDR]
+
+/* One entry per I/O address (0xF00-0xF7F), missing entries read 0 and ignore writes */
+static const io_reg_t io_regs[MEM_IO_SIZE] = {
+  IO_REG(REG_CLK_INT_FACTOR_FLAGS)        = {io_get_int_factor, NULL},
+  IO_REG(REG_SW_INT_FACTOR_FLAGS)         = {io_get_int_factor, NULL},
+  IO_REG(REG_PROG_INT_FACTOR_FLAGS)       = {io_get_int_factor, NULL},
+  IO_REG(REG_SERIAL_INT_FACTOR_FLAGS)     = {io_get_int_factor, NULL},
+  IO_REG(REG_K00_K03_INT_FACTOR_FLAGS)    = {io_get_int_factor, NULL},
+  IO_REG(REG_K10_K13_INT_FACTOR_FLAGS)    = {io_get_int_factor, NULL},
+  IO_REG(REG_CLOCK_INT_MASKS)             = {io_get_int_mask, io_set_int_mask},
+  IO_REG(REG_SW_INT_MASKS)                = {io_get_int_mask, io_set_int_mask},
+  IO_REG(REG_PROG_INT_MASKS)              = {io_get_int_mask, io_set_int_mask},
+  IO_REG(REG_SERIAL_INT_MASKS)            = {io_get_int_mask, io_set_int_mask},
+  IO_REG(REG_K00_K03_INT_MASKS)           = {io_get_int_mask, io_set_int_mask},
+  IO_REG(REG_K10_K13_INT_MASKS)           = {io_get_int_mask, io_set_int_mask},
+  IO_REG(REG_PROG_TIMER_DATA_L)           = {io_get_prog_timer, NULL},
+  IO_REG(REG_PROG_TIMER_DATA_H)           = {io_get_prog_timer, NULL},
+  IO_REG(REG_PROG_TIMER_RELOAD_DATA_L)    = {io_get_prog_timer, io_set_prog_timer_rld},
+  IO_REG(REG_PROG_TIMER_RELOAD_DATA_H)    = {io_get_prog_timer, io_set_prog_timer_rld},
+  IO_REG(REG_K00_K03_INPUT_PORT)          = {io_get_input_port, NULL},
+  IO_REG(REG_K10_K13_INPUT_PORT)          = {io_get_input_port, NULL},
+  IO_REG(REG_K40_K43_BZ_OUTPUT_PORT)      = {io_get_plain, io_set_bz_output_port},
+  IO_REG(REG_SW_TIMER_DATA_L)             = {io_get_sw_timer, NULL},
+  IO_REG(REG_SW_TIMER_DATA_H)             = {io_get_sw_timer, NULL},
+  IO_REG(REG_CPU_OSC3_CTRL)               = {io_get_plain, io_set_plain},
+  IO_REG(REG_LCD_CTRL)                    = {io_get_plain, io_set_plain},
+  IO_REG(REG_LCD_CONTRAST)                = {io_get_plain, io_set_plain},
+  IO_REG(REG_SVD_CTRL)                    = {io_get_svd, io_set_plain},
+  IO_REG(REG_BUZZER_CTRL1)                = {io_get_plain, io_set_buzzer_ctrl1},
+  IO_REG(REG_BUZZER_CTRL2)                = {io_get_buzzer_ctrl2, io_set_plain},
+  IO_REG(REG_CLK_WD_TIMER_CTRL)           = {NULL, io_set_clk_wd_timer_ctrl},
+  IO_REG(REG_SW_TIMER_CTRL)               = {io_get_sw_timer_ctrl, io_set_sw_timer_ctrl},
+  IO_REG(REG_PROG_TIMER_CTRL)             = {io_get_prog_timer_ctrl, io_set_prog_timer_ctrl},
+  IO_REG(REG_PROG_TIMER_CLK_SEL)          = {io_get_plain, io_set_prog_timer_clk_sel},
+};
 
-    default:
-      break;
-      //g_hal->log(LOG_ERROR,   "Write 0x%X to unimplemented I/O 0x%03X - PC = 0x%04X\n", v, n, pc);
-  }
+static u4_t get_io(u12_t n)
+{
+  const io_reg_t *reg = &io_regs[n - MEM_IO_ADDR];
+
+  return (reg->get != NULL) ? reg->get(n) : 0;
 }
 
-static void set_lcd(u12_t n, u4_t v)
+static void set_io(u12_t n, u4_t v)
 {
-  u8_t i;
-  u8_t seg, com0;
-
-  seg = ((n & 0x7F) >> 1);
-  com0 = (((n & 0x80) >> 7) * 8 + (n & 0x1) * 4);
+  const io_reg_t *reg = &io_regs[n - MEM_IO_ADDR];
 
-  for (i = 0; i < 4; i++) {
-    hw_set_lcd_pin(seg, com0 + i, (v >> i) & 0x1);
+  if (reg->set != NULL) {
+    reg->set(n, v);
   }
 }
 
@@ -640,29 +777,21 @@ u8_t cpu_get_max_number() {
 static u4_t get_memory(u12_t n)
 {
   u4_t res = 0;
-  
 
   if (n < MEM_RAM_SIZE) {
-    /* RAM */
-    //g_hal->log(LOG_MEMORY, "RAM              - ");
-    //if (n > max_memory_addr_access) max_memory_addr_access = n;
-    if ((n & 0x1)==0) {
-      res = memory[n>>1] >> 4;
-    } else {
-      res = memory[n>>1] & 0b00001111;
-    }
-    
-  } else if (n >= MEM_DISPLAY1_ADDR && n < (MEM_DISPLAY1_ADDR + MEM_DISPLAY1_SIZE)) {
+    /* RAM, by far the most frequent access */
+    return RAM_GET(n);
+  }
+
+  if (n >= MEM_DISPLAY1_ADDR && n < (MEM_DISPLAY1_ADDR + MEM_DISPLAY1_SIZE)) {
     /* Display Memory 1 */
     //g_hal->log(LOG_MEMORY, "Display Memory 1 - ");
-    //res = memory[n - MEM_DISPLAY1_ADDR_OFS];
-      res = 0;  
+    res = hw_get_lcd_nibble(n);
 
   } else if (n >= MEM_DISPLAY2_ADDR && n < (MEM_DISPLAY2_ADDR + MEM_DISPLAY2_SIZE)) {
     /* Display Memory 2 */
     //g_hal->log(LOG_MEMORY, "Display Memory 2 - ");
-    //res = memory[n - MEM_DISPLAY2_ADDR_OFS];
-      res = 0;  
+    res = hw_get_lcd_nibble(n);
   } else if (n >= MEM_IO_ADDR && n < (MEM_IO_ADDR + MEM_IO_SIZE)) {
     /* I/O Memory */
     //g_hal->log(LOG_MEMORY, "I/O              - ");
@@ -681,17 +810,13 @@ static void set_memory(u12_t n, u4_t v)
 {
   if (n < MEM_RAM_SIZE) {
     /* RAM */
-    if ((n & 0x1)==0) {
-      memory[n>>1] = (memory[n>>1] & 0x0F) | (v << 4);
-    } else {
-      memory[n>>1] = (memory[n>>1] & 0xF0) | v;
-    }
+    RAM_SET(n, v);
   } else if (n >= MEM_DISPLAY1_ADDR && n < (MEM_DISPLAY1_ADDR + MEM_DISPLAY1_SIZE)) {
     /* Display Memory 1 */
-    set_lcd(n, v);
+    hw_set_lcd_nibble(n, v);
   } else if (n >= MEM_DISPLAY2_ADDR && n < (MEM_DISPLAY2_ADDR + MEM_DISPLAY2_SIZE)) {
     /* Display Memory 2 */
-    set_lcd(n, v);
+    hw_set_lcd_nibble(n, v);
   } else if (n >= MEM_IO_ADDR && n < (MEM_IO_ADDR + MEM_IO_SIZE)) {
     /* I/O Memory */
     set_io(n, v);
@@ -714,8 +839,7 @@ void cpu_refresh_hw(void)
   };
 
   // Refresh hardware by writing to memory-mapped registers
-  // For display memory, write 0 to trigger the hardware callbacks
-  // This forces the display to update even though display memory isn't persisted
+  // Display memory is not persisted, so it is cleared and the ROM redraws it
   for (int i = 0; refresh_locs[i].size != 0; i++) {
     for (u12_t n = refresh_locs[i].addr; n < (refresh_locs[i].addr + refresh_locs[i].size); n++) {
       // For display addresses, write 0 since display memory is not stored
@@ -1808,25 +1932,21 @@ static timestamp_t wait_for_cycles(timestamp_t since, u8_t cycles) {
 
 static void process_interrupts(void)
 {
-  u8_t i;
+  /* Highest priority first: the lowest slot */
+  u8_t i = __builtin_ctz(int_pending);
 
-  /* Process interrupts in priority order */
-  for (i = 0; i < INT_SLOT_NUM; i++) {
-    if (interrupts[i].triggered) {
-      //printf("IT %u !\n", i);
-      SET_M(sp - 1, PCP);
-      SET_M(sp - 2, PCSH);
-      SET_M(sp - 3, PCSL);
-      sp = (sp - 3) & 0xFF;
-      CLEAR_I();
-      np = TO_NP(NBP, 1);
-      pc = TO_PC(PCB, 1, interrupts[i].vector);
-      call_depth++;
-
-      ref_ts = wait_for_cycles(ref_ts, 12);
-      interrupts[i].triggered = 0;
-    }
-  }
+  //printf("IT %u !\n", i);
+  SET_M(sp - 1, PCP);
+  SET_M(sp - 2, PCSH);
+  SET_M(sp - 3, PCSL);
+  sp = (sp - 3) & 0xFF;
+  CLEAR_I();
+  np = TO_NP(NBP, 1);
+  pc = TO_PC(PCB, 1, interrupts[i].vector);
+  call_depth++;
+
+  ref_ts = wait_for_cycles(ref_ts, 12);
+  int_pending &= ~(0x1 << i);
 }
 
 static void print_state(u8_t op_num, u12_t op, u13_t addr)
@@ -1853,6 +1973,24 @@ void cpu_reset(void)
   for (i = 0; i < MEMORY_SIZE; i++) {
     memory[i] = 0;
   }
+#ifdef CPU_UNPACKED_RAM
+  for (i = 0; i < MEM_RAM_SIZE; i++) {
+    ram[i] = 0;
+  }
+#endif
+
+  /* I/O registers to their reset values (R43 high: buzzer off) */
+  for (i = 0; i < MEM_IO_SIZE; i++) {
+    io_memory[i] = 0;
+  }
+  io_memory[REG_K40_K43_BZ_OUTPUT_PORT - MEM_IO_ADDR] = 0xF;
+  /* Not saved: restored games need the 256 Hz the ROM selects */
+  io_memory[REG_PROG_TIMER_CLK_SEL - MEM_IO_ADDR] = 0x2;
+
+  sw_timer_enabled = 0;
+  sw_timer_data = 0;
+  wd_timer_timestamp = tick_counter;
+  update_timer_due();
 
   cpu_sync_ref_timestamp();
 }
@@ -1890,6 +2028,12 @@ int cpu_step(void)
   u8_t i;
   static u8_t previous_cycles = 0;
 
+  /* A corrupted RAM stack can return outside the ROM: stop rather than read past it */
+  if (pc >= ROM_WORDS) {
+    g_hal->log(LOG_ERROR, "PC outside the ROM - PC = 0x%04X\n", pc);
+    return 1;
+  }
+
   op = getProgramOpCode(pc);
 
   //op_t0 *ops = (op_t0 *)pgm_read_ptr_near(ops0);
@@ -1951,29 +2095,13 @@ int cpu_step(void)
     np = (pc >> 8) & 0x1F;
   }
 
-  /* Handle timers using the internal tick counter */
-  if (tick_counter - clk_timer_timestamp >= TIMER_1HZ_PERIOD) {
-    do {
-      clk_timer_timestamp += TIMER_1HZ_PERIOD;
-    } while (tick_counter - clk_timer_timestamp >= TIMER_1HZ_PERIOD);
-
-    generate_interrupt(INT_CLOCK_TIMER_SLOT, 3);
-  }
-
-  if (prog_timer_enabled && tick_counter - prog_timer_timestamp >= TIMER_256HZ_PERIOD) {
-    do {
-      prog_timer_timestamp += TIMER_256HZ_PERIOD;
-      prog_timer_data--;
-
-      if (prog_timer_data == 0) {
-        prog_timer_data = prog_timer_rld;
-        generate_interrupt(INT_PROG_TIMER_SLOT, 0);
-      }
-    } while (tick_counter - prog_timer_timestamp >= TIMER_256HZ_PERIOD);
+  /* Timers: a single compare until the earliest one is due */
+  if (timer_distance(timer_due) <= 0) {
+    process_timers();
   }
 
   /* Check if there is any pending interrupt */
-  if (I && i > 0) { // Do not process interrupts after a PSET operation
+  if (int_pending && I && i > 0) { // Do not process interrupts after a PSET operation
     process_interrupts();
   }
 
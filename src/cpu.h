@@ -24,6 +24,11 @@
 
 #define MEMORY_SIZE        0x140 // MEM_RAM_SIZE + MEM_IO_SIZE
 
+/* Host builds with memory to spare can define CPU_UNPACKED_RAM to keep the RAM
+ * one nibble per byte. cpu_state_t.memory stays packed: cpu_get_state() refreshes
+ * it and cpu_set_state() loads it back, it is not a live view in that case.
+ */
+
 #define MEM_RAM_ADDR        0x000
 #define MEM_RAM_SIZE        0x280
 
@@ -40,6 +45,11 @@
 #define MEM_IO_ADDR_OFS   0xF00
 #define MEM_IO_SIZE       0x080
 
+#define TICK_FREQUENCY        32768 // Hz
+
+#define TIMER_1HZ_PERIOD      32768 // in ticks
+#define TIMER_256HZ_PERIOD      128 // in ticks
+
 typedef struct breakpoint {
   u13_t addr;
   struct breakpoint *next;
@@ -138,8 +148,18 @@ void cpu_free_bp(breakpoint_t **list);
 void cpu_get_state(cpu_state_t *cpustate);
 void cpu_set_state(cpu_state_t *cpustate);
 
+/* True if cpustate can be given to cpu_set_state(): register widths, PC inside
+ * the ROM, timer timestamps and interrupt vectors (memory is not checked) */
+bool_t cpu_check_state(const cpu_state_t *cpustate);
+
 u32_t cpu_get_depth(void);
 
+/* Emulated time, in 32768 Hz ticks */
+u32_t cpu_get_ticks(void);
+
+/* Emulated ticks until the next clock or programmable timer interrupt */
+u32_t cpu_get_ticks_to_next_event(void);
+
 void cpu_set_input_pin(pin_t pin, pin_state_t state);
 
 void cpu_sync_ref_timestamp(void);
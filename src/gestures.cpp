@@ -0,0 +1,233 @@
+// gestures.cpp
+// KidsBar: encoder gesture engine feeding TamaLib's input queue (see gestures.h).
+#include "gestures.h"
+
+#include <esp_timer.h>
+
+#include "config.h"
+#include "input_events.h"
+#include "low_power.h"
+
+extern "C" {
+#include "cpu.h"
+#include "hw.h"
+}
+
+static const u32_t HOLD_TICKS = BTN_HOLD_PERIODS * TIMER_256HZ_PERIOD;
+static const u32_t GAP_TICKS = BTN_GAP_PERIODS * TIMER_256HZ_PERIOD;
+
+static const int64_t DOUBLE_US = GESTURE_DOUBLE_MS * 1000LL;
+static const int64_t LONG_US = GESTURE_LONG_MS * 1000LL;
+static const int64_t VERY_LONG_US = GESTURE_VERY_LONG_MS * 1000LL;
+static const int64_t ACCEL_US = GESTURE_ACCEL_MS * 1000LL;
+
+// Queue entries one step may need: a chord of the 3 buttons or an accelerated detent
+static const u8_t QUEUE_NEED = 2 * (GESTURE_ACCEL_MAX > 3 ? GESTURE_ACCEL_MAX : 3);
+static_assert(QUEUE_NEED <= INPUT_QUEUE_SIZE, "GESTURE_ACCEL_MAX does not fit TamaLib's queue");
+
+// Encoder button
+enum SwState : uint8_t {
+  SW_IDLE,
+  SW_DOWN,   // First press, not classified yet
+  SW_WAIT,   // Released: a second press now is a double click
+  SW_DOWN2,  // Second press
+  SW_HELD,   // Long press with no action: B is down until the release
+  SW_DONE,   // Gesture sent, the release only ends it
+};
+
+static SwState s_sw = SW_IDLE;
+static bool s_swDown = false;       // Down as far as the events went
+static int64_t s_downUs = 0;        // Latest press
+static int64_t s_upUs = 0;          // Latest release
+static bool s_veryLongSent = false;
+
+// Encoder acceleration
+static int s_lastDir = 0;
+static int64_t s_lastDetentUs = 0;
+
+// TamaLib queue bookkeeping (emulated ticks)
+static u32_t s_queuedTick = 0;        // Last change queued (the queue is in tick order)
+static u32_t s_btnFreeTick[3] = {};   // Per button: first tick it may go down again
+static u32_t s_heldDownTick = 0;      // When B went down in SW_HELD
+
+static GestureAction s_pending = GESTURE_NONE;  // For the caller
+
+// Later of two ticks (wrapping compare)
+static u32_t laterTick(u32_t a, u32_t b) {
+  return (int32_t)(b - a) > 0 ? b : a;
+}
+
+// Queue one change at `at`, or later: it can't go before the emulated present or
+// before the last queued change. Callers check hw_queue_space().
+static void queueChange(button_t btn, btn_state_t state, u32_t at) {
+  at = laterTick(laterTick(at, cpu_get_ticks()), s_queuedTick);
+  hw_queue_button(btn, state, at);
+  s_queuedTick = at;
+}
+
+// Press the buttons of `chord` together for `hold` ticks (at least HOLD_TICKS)
+static void queueChord(uint8_t chord, u32_t at, u32_t hold) {
+  for (int b = 0; b < 3; b++) {
+    if (chord & (1 << b)) at = laterTick(at, s_btnFreeTick[b]);
+  }
+  for (int b = 0; b < 3; b++) {
+    if (chord & (1 << b)) queueChange((button_t)b, BTN_STATE_PRESSED, at);
+  }
+  u32_t release = s_queuedTick + (hold > HOLD_TICKS ? hold : HOLD_TICKS);
+  for (int b = 0; b < 3; b++) {
+    if (!(chord & (1 << b))) continue;
+    queueChange((button_t)b, BTN_STATE_RELEASED, release);
+    s_btnFreeTick[b] = s_queuedTick + GAP_TICKS;
+  }
+}
+
+static void send(GestureAction action, int64_t us, int64_t holdUs) {
+  if (action == GESTURE_NONE) return;
+  if (action >= GESTURE_REWIND) {
+    s_pending = action;
+    return;
+  }
+  queueChord(action, lowPowerTicksAt(us), (u32_t)(holdUs * TICK_FREQUENCY / 1000000));
+}
+
+// Once the queue ran dry nothing pending can be further ahead than one gap.
+// Restores go through gesturesReset() instead.
+static void clampTicks() {
+  if (hw_queue_space() != INPUT_QUEUE_SIZE) return;
+  u32_t now = cpu_get_ticks();
+  u32_t limit = now + GAP_TICKS;
+  s_queuedTick = now;
+  for (u32_t& t : s_btnFreeTick) {
+    if ((int32_t)(t - limit) > 0) t = limit;
+  }
+  if ((int32_t)(s_heldDownTick - now) > 0) s_heldDownTick = now;
+}
+
+// Classify the button once enough time passed without an event
+static void expire(int64_t now) {
+  switch (s_sw) {
+    case SW_DOWN:
+      if (now - s_downUs < LONG_US) break;
+      if (GESTURE_LONG_PRESS == GESTURE_NONE) {
+        u32_t at = laterTick(lowPowerTicksAt(s_downUs), s_btnFreeTick[BTN_MIDDLE]);
+        queueChange(BTN_MIDDLE, BTN_STATE_PRESSED, at);
+        s_heldDownTick = s_queuedTick;
+        s_sw = SW_HELD;
+      } else {
+        send(GESTURE_LONG_PRESS, s_downUs + LONG_US, 0);
+        s_sw = SW_DONE;
+      }
+      break;
+    case SW_DOWN2:
+      if (now - s_downUs < LONG_US) break;
+      send(GESTURE_DOUBLE_CLICK, s_downUs, 0);  // Second press held: still a double click
+      s_sw = SW_DONE;
+      break;
+    case SW_WAIT:
+      if (now - s_upUs < DOUBLE_US) break;
+      send(GESTURE_CLICK, s_downUs, s_upUs - s_downUs);
+      s_sw = SW_IDLE;
+      break;
+    default:
+      break;
+  }
+
+  if (s_swDown && !s_veryLongSent && now - s_downUs >= VERY_LONG_US) {
+    send(GESTURE_VERY_LONG_PRESS, s_downUs + VERY_LONG_US, 0);
+    s_veryLongSent = true;
+  }
+}
+
+static void detent(int dir, int64_t us) {
+  // Turning with the button down: B+C / A+B, and the press is used up
+  if (s_sw == SW_DOWN || s_sw == SW_DOWN2) {
+    send(dir > 0 ? GESTURE_BC : GESTURE_AB, us, 0);
+    s_sw = SW_DONE;
+    return;
+  }
+
+  int taps = 1;
+  if (dir == s_lastDir && us > s_lastDetentUs) {
+    taps = (int)(ACCEL_US / (us - s_lastDetentUs));
+    if (taps < 1) taps = 1;
+    if (taps > GESTURE_ACCEL_MAX) taps = GESTURE_ACCEL_MAX;
+  }
+  s_lastDir = dir;
+  s_lastDetentUs = us;
+
+  u32_t at = lowPowerTicksAt(us);
+  for (int i = 0; i < taps; i++) queueChord(dir > 0 ? GESTURE_C : GESTURE_A, at, 0);
+}
+
+static void press(int64_t us) {
+  s_sw = (s_sw == SW_WAIT) ? SW_DOWN2 : SW_DOWN;
+  s_swDown = true;
+  s_downUs = us;
+  s_veryLongSent = false;
+}
+
+static void release(int64_t us) {
+  if (!s_swDown) return;  // Went down before the game started
+  s_swDown = false;
+
+  switch (s_sw) {
+    case SW_DOWN:
+      if (GESTURE_DOUBLE_CLICK == GESTURE_NONE) {
+        send(GESTURE_CLICK, s_downUs, us - s_downUs);
+        s_sw = SW_IDLE;
+      } else {
+        s_upUs = us;
+        s_sw = SW_WAIT;
+      }
+      break;
+    case SW_DOWN2:
+      send(GESTURE_DOUBLE_CLICK, s_downUs, us - s_downUs);
+      s_sw = SW_IDLE;
+      break;
+    case SW_HELD: {
+      u32_t at = laterTick(lowPowerTicksAt(us), s_heldDownTick + HOLD_TICKS);
+      queueChange(BTN_MIDDLE, BTN_STATE_RELEASED, at);
+      s_btnFreeTick[BTN_MIDDLE] = s_queuedTick + GAP_TICKS;
+      s_sw = SW_IDLE;
+      break;
+    }
+    default:
+      s_sw = SW_IDLE;
+      break;
+  }
+}
+
+void gesturesReset() {
+  u32_t now = cpu_get_ticks();
+  s_queuedTick = now;
+  for (u32_t& t : s_btnFreeTick) t = now;
+  s_heldDownTick = now;
+  s_swDown = inputButtonDown();  // A menu may have consumed the release
+  s_sw = s_swDown ? SW_DONE : SW_IDLE;
+}
+
+GestureAction gesturesPoll() {
+  int64_t now = esp_timer_get_time();  // Before the ring is read: every earlier event is in it
+  clampTicks();
+
+  // Time-outs are judged at each event's time, so a backlog classifies the same
+  // way as live input
+  InputEvent ev;
+  while (s_pending == GESTURE_NONE && hw_queue_space() >= QUEUE_NEED && inputEventPeek(&ev)) {
+    expire(ev.us);
+    if (s_pending != GESTURE_NONE || hw_queue_space() < QUEUE_NEED) break;
+
+    switch (ev.type) {
+      case INPUT_EVENT_CW:      detent(1, ev.us);  break;
+      case INPUT_EVENT_CCW:     detent(-1, ev.us); break;
+      case INPUT_EVENT_PRESS:   press(ev.us);      break;
+      case INPUT_EVENT_RELEASE: release(ev.us);    break;
+    }
+    inputEventConsume();
+  }
+  if (s_pending == GESTURE_NONE && hw_queue_space() >= QUEUE_NEED) expire(now);
+
+  GestureAction action = s_pending;
+  s_pending = GESTURE_NONE;
+  return action;
+}
@@ -22,8 +22,52 @@
 #include "cpu.h"
 #include "hal.h"
 
-/* SEG -> LCD mapping */
-const static u8_t seg_pos[40] = {0, 1, 2, 3, 4, 5, 6, 7, 32, 8, 9, 10, 11, 12 ,13 ,14, 15, 33, 34, 35, 31, 30, 29, 28, 27, 26, 25, 24, 36, 23, 22, 21, 20, 19, 18, 17, 16, 37, 38, 39};
+/* LCD column -> SEG mapping of the dot matrix */
+const static u8_t pos_seg[LCD_WIDTH] = {0, 1, 2, 3, 4, 5, 6, 7, 9, 10, 11, 12, 13, 14, 15, 16, 36, 35, 34, 33, 32, 31, 30, 29, 27, 26, 25, 24, 23, 22, 21, 20};
+
+/*
+ * IC n -> seg-com|...
+ * IC 0 ->  8-0 |18-3 |19-2
+ * IC 1 ->  8-1 |17-0 |19-3
+ * IC 2 ->  8-2 |17-1 |37-12|38-13|39-14
+ * IC 3 ->  8-3 |17-2 |18-1 |19-0
+ * IC 4 -> 28-12|37-13|38-14|39-15
+ * IC 5 -> 28-13|37-14|38-15
+ * IC 6 -> 28-14|37-15|39-12
+ * IC 7 -> 28-15|38-12|39-13
+ */
+#define ICON_SEG_LOW			8  // Icons 0-3 on COM 0-3
+#define ICON_SEG_HIGH			28 // Icons 4-7 on COM 12-15
+
+/* COM lines of each SEG that end up on screen */
+const static uint16_t seg_visible[40] = {
+	0xFFFF, 0xFFFF, 0xFFFF, 0xFFFF, 0xFFFF, 0xFFFF, 0xFFFF, 0xFFFF, 0x000F, 0xFFFF,
+	0xFFFF, 0xFFFF, 0xFFFF, 0xFFFF, 0xFFFF, 0xFFFF, 0xFFFF, 0x0000, 0x0000, 0x0000,
+	0xFFFF, 0xFFFF, 0xFFFF, 0xFFFF, 0xFFFF, 0xFFFF, 0xFFFF, 0xFFFF, 0xF000, 0xFFFF,
+	0xFFFF, 0xFFFF, 0xFFFF, 0xFFFF, 0xFFFF, 0xFFFF, 0xFFFF, 0x0000, 0x0000, 0x0000,
+};
+
+/* Display RAM, one word per SEG line (bit n = COM n).
+ * Nibble writes only land here, the frame is built on demand by hw_get_lcd_frame().
+ */
+static uint16_t lcd_segs[40] = {0};
+
+/* Activity counters (free running, consumers compare against their last read) */
+static u32_t lcd_changes = 0;
+static u32_t input_edges = 0;
+
+static btn_state_t btn_states[3] = {BTN_STATE_RELEASED, BTN_STATE_RELEASED, BTN_STATE_RELEASED};
+
+/* Button changes waiting for their emulated tick (ring, indexes wrap freely) */
+typedef struct {
+	u32_t tick;
+	u8_t btn;
+	u8_t state;
+} input_event_t;
+
+static input_event_t input_queue[INPUT_QUEUE_SIZE];
+static u8_t input_head = 0;
+static u8_t input_tail = 0;
 
 
 bool_t hw_init(void)
@@ -39,34 +83,60 @@ void hw_release(void)
 {
 }
 
-void hw_set_lcd_pin(u8_t seg, u8_t com, u8_t val)
+/* Display memory address -> SEG line and first COM line of the nibble */
+#define LCD_NIBBLE_SEG(n)		(((n) & 0x7F) >> 1)
+#define LCD_NIBBLE_COM(n)		((((n) & 0x80) >> 7) * 8 + ((n) & 0x1) * 4)
+
+void hw_set_lcd_nibble(u12_t n, u4_t v)
 {
-	if (seg_pos[seg] < LCD_WIDTH) {
-		g_hal->set_lcd_matrix(seg_pos[seg], com, val);
-	} else {
-		/*
-		 * IC n -> seg-com|...
-		 * IC 0 ->  8-0 |18-3 |19-2
-		 * IC 1 ->  8-1 |17-0 |19-3
-		 * IC 2 ->  8-2 |17-1 |37-12|38-13|39-14
-		 * IC 3 ->  8-3 |17-2 |18-1 |19-0
-		 * IC 4 -> 28-12|37-13|38-14|39-15
-		 * IC 5 -> 28-13|37-14|38-15
-		 * IC 6 -> 28-14|37-15|39-12
-		 * IC 7 -> 28-15|38-12|39-13
-		 */
-		if (seg == 8 && com < 4) {
-			g_hal->set_lcd_icon(com, val);
-		} else if (seg == 28 && com >= 12) {
-			g_hal->set_lcd_icon(com - 8, val);
+	u8_t seg = LCD_NIBBLE_SEG(n);
+	u8_t com0 = LCD_NIBBLE_COM(n);
+	uint16_t old = lcd_segs[seg];
+	uint16_t val = (old & ~(0xF << com0)) | ((v & 0xF) << com0);
+
+	if (val != old) {
+		lcd_segs[seg] = val;
+		lcd_changes += __builtin_popcount((old ^ val) & seg_visible[seg]);
+	}
+}
+
+u4_t hw_get_lcd_nibble(u12_t n)
+{
+	return (lcd_segs[LCD_NIBBLE_SEG(n)] >> LCD_NIBBLE_COM(n)) & 0xF;
+}
+
+void hw_get_lcd_frame(u32_t matrix[LCD_HEIGHT], u8_t *icons)
+{
+	u8_t x, y;
+	uint16_t col;
+
+	for (y = 0; y < LCD_HEIGHT; y++) {
+		matrix[y] = 0;
+	}
+
+	/* Transpose the SEG (column) words into rows, visiting lit pixels only */
+	for (x = 0; x < LCD_WIDTH; x++) {
+		col = lcd_segs[pos_seg[x]];
+		while (col) {
+			matrix[__builtin_ctz(col)] |= LCD_ROW_BIT(x);
+			col &= col - 1;
 		}
 	}
+
+	*icons = (lcd_segs[ICON_SEG_LOW] & 0xF) | ((lcd_segs[ICON_SEG_HIGH] >> 8) & 0xF0);
 }
 
 void hw_set_button(button_t btn, btn_state_t state)
 {
 	pin_state_t pin_state = (state == BTN_STATE_PRESSED) ? PIN_STATE_LOW : PIN_STATE_HIGH;
 
+	/* The K0x interrupts are edge triggered: an unchanged level is a no-op */
+	if (btn_states[btn] == state) {
+		return;
+	}
+	btn_states[btn] = state;
+	input_edges++;
+
 	switch (btn) {
 		case BTN_LEFT:
 			cpu_set_input_pin(PIN_K02, pin_state);
@@ -82,6 +152,73 @@ void hw_set_button(button_t btn, btn_state_t state)
 	}
 }
 
+bool_t hw_queue_button(button_t btn, btn_state_t state, u32_t tick)
+{
+	input_event_t *e;
+
+	if ((u8_t)(input_tail - input_head) >= INPUT_QUEUE_SIZE) {
+		return 0;
+	}
+
+	e = &input_queue[input_tail & (INPUT_QUEUE_SIZE - 1)];
+	e->tick = tick;
+	e->btn = btn;
+	e->state = state;
+	input_tail++;
+	return 1;
+}
+
+u8_t hw_queue_space(void)
+{
+	return INPUT_QUEUE_SIZE - (u8_t)(input_tail - input_head);
+}
+
+void hw_apply_inputs(u32_t tick)
+{
+	input_event_t *e;
+
+	while (input_head != input_tail) {
+		e = &input_queue[input_head & (INPUT_QUEUE_SIZE - 1)];
+		if ((int32_t)(tick - e->tick) < 0) {
+			break;
+		}
+		hw_set_button((button_t) e->btn, (btn_state_t) e->state);
+		input_head++;
+	}
+}
+
+bool_t hw_next_input_tick(u32_t *tick)
+{
+	if (input_head == input_tail) {
+		return 0;
+	}
+
+	*tick = input_queue[input_head & (INPUT_QUEUE_SIZE - 1)].tick;
+	return 1;
+}
+
+void hw_clear_inputs(void)
+{
+	u8_t btn;
+
+	input_head = input_tail;
+
+	/* A release still queued would never come */
+	for (btn = 0; btn < 3; btn++) {
+		hw_set_button((button_t) btn, BTN_STATE_RELEASED);
+	}
+}
+
+u32_t hw_get_lcd_changes(void)
+{
+	return lcd_changes;
+}
+
+u32_t hw_get_input_edges(void)
+{
+	return input_edges;
+}
+
 const static uint16_t snd_freq[]= {4096,3279,2731,2341,2048,1638,1365,1170};
 void hw_set_buzzer_freq(u4_t freq)
 {
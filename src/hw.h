@@ -27,6 +27,9 @@
 
 #define ICON_NUM			8
 
+/* Rows of a frame are 32-bit words, leftmost pixel in the MSB */
+#define LCD_ROW_BIT(x)			(0x80000000UL >> (x))
+
 typedef enum {
 	BTN_STATE_RELEASED = 0,
 	BTN_STATE_PRESSED,
@@ -46,9 +49,37 @@ typedef enum {
 bool_t hw_init(void);
 void hw_release(void);
 
-void hw_set_lcd_pin(u8_t seg, u8_t com, u8_t val);
+/* Display memory (0xE00-0xE4F/0xE80-0xECF) accessors, no HAL callback involved */
+void hw_set_lcd_nibble(u12_t n, u4_t v);
+u4_t hw_get_lcd_nibble(u12_t n);
+
+/* Build the current 32x16 frame (one word per row) and icon mask (bit n = icon n) */
+void hw_get_lcd_frame(u32_t matrix[LCD_HEIGHT], u8_t *icons);
 void hw_set_button(button_t btn, btn_state_t state);
 
+#define INPUT_QUEUE_SIZE		16 // Power of 2
+
+/* Button changes applied when the emulated clock reaches tick, in the order queued
+ * (queue them in tick order). Returns 0 if the queue is full.
+ * hw_apply_inputs() runs the due ones; the main loop calls it between instruction batches.
+ * hw_queue_space() is the number of changes that can still be queued.
+ */
+bool_t hw_queue_button(button_t btn, btn_state_t state, u32_t tick);
+u8_t hw_queue_space(void);
+void hw_apply_inputs(u32_t tick);
+
+/* Tick of the oldest queued change, to end an instruction batch there.
+ * Returns 0 if the queue is empty.
+ */
+bool_t hw_next_input_tick(u32_t *tick);
+
+/* Drop the queued changes and release the buttons (the emulated clock jumped) */
+void hw_clear_inputs(void);
+
+/* Free running counters of LCD pixel/icon transitions and button edges */
+u32_t hw_get_lcd_changes(void);
+u32_t hw_get_input_edges(void);
+
 void hw_set_buzzer_freq(u4_t freq);
 void hw_enable_buzzer(bool_t en);
 
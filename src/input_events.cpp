@@ -0,0 +1,117 @@
+// input_events.cpp
+// KidsBar: SPSC ring of timestamped input events filled from interrupts (see input_events.h).
+#include "input_events.h"
+
+#include <atomic>
+#include <driver/gpio.h>
+#include <esp_timer.h>
+
+static InputEvent s_ring[INPUT_EVENT_SLOTS];
+static std::atomic<uint32_t> s_head(0);  // next slot to fill (interrupts)
+static std::atomic<uint32_t> s_tail(0);  // next slot to read (loop only)
+static std::atomic<uint32_t> s_dropped(0);
+
+static int s_swPin = -1;
+static portMUX_TYPE s_btnMux = portMUX_INITIALIZER_UNLOCKED;
+static bool s_btnDown = false;    // Level last reported
+static int64_t s_btnEdgeUs = 0;   // When it was reported
+static std::atomic<bool> s_btnPending(false);  // A change is waiting for the window to end
+
+bool IRAM_ATTR inputEventPush(InputEventType type, int64_t us) {
+  uint32_t head = s_head.load(std::memory_order_relaxed);
+  if (head - s_tail.load(std::memory_order_acquire) >= INPUT_EVENT_SLOTS) {
+    s_dropped.fetch_add(1, std::memory_order_relaxed);
+    return false;
+  }
+  InputEvent& ev = s_ring[head & (INPUT_EVENT_SLOTS - 1)];
+  ev.us = us;
+  ev.type = type;
+  s_head.store(head + 1, std::memory_order_release);
+  return true;
+}
+
+// Report the button level if it changed and the previous edge stopped bouncing;
+// otherwise flag the change so the loop reports it later.
+// Callers hold s_btnMux with interrupts off on this core.
+static void IRAM_ATTR sampleButton(int64_t now) {
+  bool down = gpio_get_level((gpio_num_t)s_swPin) == 0;
+  bool report = down != s_btnDown;
+  if (report && now - s_btnEdgeUs >= INPUT_DEBOUNCE_US &&
+      inputEventPush(down ? INPUT_EVENT_PRESS : INPUT_EVENT_RELEASE, now)) {
+    s_btnDown = down;
+    s_btnEdgeUs = now;
+    report = false;
+  }
+  s_btnPending.store(report, std::memory_order_relaxed);
+}
+
+static void IRAM_ATTR buttonIsr() {
+  portENTER_CRITICAL_ISR(&s_btnMux);
+  sampleButton(esp_timer_get_time());
+  portEXIT_CRITICAL_ISR(&s_btnMux);
+}
+
+// From the loop: the same path as the interrupt, with interrupts off so the
+// encoder cannot push in the middle
+static void resampleButton() {
+  if (s_swPin < 0) return;
+  portENTER_CRITICAL(&s_btnMux);
+  sampleButton(esp_timer_get_time());
+  portEXIT_CRITICAL(&s_btnMux);
+}
+
+void inputEventsBegin(int swPin) {
+  s_swPin = swPin;
+  pinMode(swPin, INPUT_PULLUP);
+  s_btnDown = digitalRead(swPin) == LOW;
+  s_btnEdgeUs = esp_timer_get_time();
+  attachInterrupt(digitalPinToInterrupt(swPin), buttonIsr, CHANGE);
+}
+
+bool inputEventPeek(InputEvent* ev) {
+  uint32_t tail = s_tail.load(std::memory_order_relaxed);
+  if (s_head.load(std::memory_order_acquire) == tail) {
+    // An edge inside the bounce window was ignored: report the level it left once
+    // the window is over. The edge time may be read torn here; sampleButton()
+    // checks it again under the lock.
+    if (!s_btnPending.load(std::memory_order_relaxed) ||
+        esp_timer_get_time() - s_btnEdgeUs < INPUT_DEBOUNCE_US) {
+      return false;
+    }
+    resampleButton();
+    if (s_head.load(std::memory_order_acquire) == tail) return false;
+  }
+  *ev = s_ring[tail & (INPUT_EVENT_SLOTS - 1)];
+  return true;
+}
+
+void inputEventConsume() {
+  uint32_t tail = s_tail.load(std::memory_order_relaxed);
+  if (s_head.load(std::memory_order_acquire) == tail) return;
+  s_tail.store(tail + 1, std::memory_order_release);
+}
+
+void inputEventsClear() {
+  s_tail.store(s_head.load(std::memory_order_acquire), std::memory_order_release);
+}
+
+bool inputButtonDown() {
+  return s_btnDown;
+}
+
+uint32_t inputEventsDropped() {
+  return s_dropped.load(std::memory_order_relaxed);
+}
+
+void inputEventsSuspend() {
+  if (s_swPin < 0) return;
+  gpio_intr_disable((gpio_num_t)s_swPin);
+}
+
+void inputEventsResume() {
+  if (s_swPin < 0) return;
+  // gpio_wakeup_enable() left a level trigger behind
+  gpio_set_intr_type((gpio_num_t)s_swPin, GPIO_INTR_ANYEDGE);
+  gpio_intr_enable((gpio_num_t)s_swPin);
+  resampleButton();
+}
@@ -0,0 +1,130 @@
+/*
+ * KidsBar - LCD frame history for the TamaLIB core
+ *
+ * Frames are only captured when the LCD changed since the previous vsync,
+ * each one staying on screen until the next one's timestamp.
+ */
+#include <string.h>
+
+#include "lcd_history.h"
+#include "cpu.h"
+#include "lcd_matrix.h"
+
+static lcd_frame_t frames[LCD_HISTORY_DEPTH];
+static u32_t head = 0; // Index of the next frame to write (free running)
+static u32_t count = 0; // Valid frames
+
+static u32_t vsync_ts = 0; // in ticks
+static u32_t render_ts = 0; // in ticks
+static u32_t seen_lcd_changes = 0;
+
+
+void lcd_history_reset(void)
+{
+	head = 0;
+	count = 0;
+	vsync_ts = cpu_get_ticks();
+	render_ts = vsync_ts;
+	seen_lcd_changes = hw_get_lcd_changes();
+}
+
+void lcd_history_vsync(void)
+{
+	u32_t ticks = cpu_get_ticks();
+	u32_t changes;
+	u32_t matrix[LCD_HEIGHT];
+	u8_t icons;
+	lcd_frame_t *f;
+
+	if (ticks - vsync_ts < LCD_HISTORY_VSYNC_TICKS) {
+		return;
+	}
+	vsync_ts = ticks;
+
+	changes = hw_get_lcd_changes();
+	if (changes == seen_lcd_changes && count != 0) {
+		return;
+	}
+	seen_lcd_changes = changes;
+
+	/* Read aside: once the ring is full, the next slot is still the oldest frame */
+	hw_get_lcd_frame(matrix, &icons);
+
+	/* Pixels toggled back and forth between two vsyncs, the previous frame is still on */
+	if (count != 0) {
+		const lcd_frame_t *prev = &frames[(head - 1) & (LCD_HISTORY_DEPTH - 1)];
+
+		if (icons == prev->icons && lcd_matrix_equal(matrix, prev->matrix)) {
+			return;
+		}
+	}
+
+	f = &frames[head & (LCD_HISTORY_DEPTH - 1)];
+	memcpy(f->matrix, matrix, sizeof(f->matrix));
+	f->icons = icons;
+	f->ts = ticks;
+
+	head++;
+	if (count < LCD_HISTORY_DEPTH) {
+		count++;
+	}
+}
+
+void lcd_history_render(lcd_render_policy_t policy, u32_t matrix[LCD_HEIGHT], u32_t ghost[LCD_HEIGHT], u8_t *icons)
+{
+	u32_t now = cpu_get_ticks();
+	u32_t window = now - render_ts;
+	u32_t end = now, held, best_held = 0;
+	const lcd_frame_t *f, *best = NULL;
+	u32_t n;
+	u8_t y;
+
+	/* The live LCD is the latest frame, even if the vsync did not catch it yet */
+	hw_get_lcd_frame(matrix, icons);
+	if (ghost != NULL) {
+		for (y = 0; y < LCD_HEIGHT; y++) {
+			ghost[y] = 0;
+		}
+	}
+
+	/* Walk back over the frames shown since the last render */
+	for (n = 0; n < count && policy != LCD_RENDER_LATEST; n++) {
+		f = &frames[(head - 1 - n) & (LCD_HISTORY_DEPTH - 1)];
+
+		if (now - f->ts >= window) {
+			/* Already on screen at the previous render, only count the part after it */
+			held = end - render_ts;
+		} else {
+			held = end - f->ts;
+		}
+
+		if (policy == LCD_RENDER_DOMINANT && held > best_held) {
+			best = f;
+			best_held = held;
+		} else if (policy == LCD_RENDER_GHOST && ghost != NULL) {
+			for (y = 0; y < LCD_HEIGHT; y++) {
+				ghost[y] |= f->matrix[y];
+			}
+		}
+
+		if (now - f->ts >= window) {
+			break;
+		}
+		end = f->ts;
+	}
+
+	if (best != NULL) {
+		for (y = 0; y < LCD_HEIGHT; y++) {
+			matrix[y] = best->matrix[y];
+		}
+		*icons = best->icons;
+	}
+
+	if (ghost != NULL) {
+		for (y = 0; y < LCD_HEIGHT; y++) {
+			ghost[y] &= ~matrix[y];
+		}
+	}
+
+	render_ts = now;
+}
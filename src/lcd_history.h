@@ -0,0 +1,48 @@
+/*
+ * KidsBar - LCD frame history for the TamaLIB core
+ *
+ * Keeps the last LCD frames captured at emulated vsync, so that a slow
+ * display (E-ink at a few fps at best) can pick the most representative
+ * frame of the elapsed period or ghost the intermediate ones, instead of
+ * showing whatever the LCD happens to contain at the sampling instant.
+ */
+#ifndef _LCD_HISTORY_H_
+#define _LCD_HISTORY_H_
+
+#include "hal.h"
+#include "hw.h"
+
+#define LCD_HISTORY_DEPTH		16 // Frames kept, must be a power of 2
+#define LCD_HISTORY_VSYNC_TICKS		1024 // 32 Hz LCD frame rate
+
+typedef struct {
+	u32_t ts; // Emulated ticks at capture
+	u32_t matrix[LCD_HEIGHT];
+	u8_t icons;
+} lcd_frame_t;
+
+typedef enum {
+	LCD_RENDER_LATEST = 0, // Current LCD content
+	LCD_RENDER_DOMINANT, // Frame that stayed on the LCD the longest since the last render
+	LCD_RENDER_GHOST, // Current LCD content + every other pixel lit since the last render
+} lcd_render_policy_t;
+
+#ifdef __cplusplus
+ extern "C" {
+#endif
+
+void lcd_history_reset(void);
+
+/* Call after each CPU step, captures a frame at each vsync if the LCD changed */
+void lcd_history_vsync(void);
+
+/* Compose the frame to display according to policy. ghost (optional) receives
+ * the pixels lit at some point since the last render but not part of matrix.
+ */
+void lcd_history_render(lcd_render_policy_t policy, u32_t matrix[LCD_HEIGHT], u32_t ghost[LCD_HEIGHT], u8_t *icons);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _LCD_HISTORY_H_ */
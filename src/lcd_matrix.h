@@ -0,0 +1,87 @@
+/*
+ * KidsBar - Word-level kernels on 32x16 LCD frames
+ *
+ * Frames are LCD_HEIGHT rows of 32 bits, leftmost pixel in the MSB
+ * (see LCD_ROW_BIT()), so every kernel handles a full row per operation.
+ */
+#ifndef _LCD_MATRIX_H_
+#define _LCD_MATRIX_H_
+
+#include "hal.h"
+#include "hw.h"
+
+typedef struct {
+	u8_t x0, y0; // Top-left pixel (inclusive)
+	u8_t x1, y1; // Bottom-right pixel (inclusive)
+} lcd_rect_t;
+
+/* Number of lit pixels */
+static inline u32_t lcd_matrix_popcount(const u32_t m[LCD_HEIGHT])
+{
+	u32_t n = 0;
+	u8_t y;
+
+	for (y = 0; y < LCD_HEIGHT; y++) {
+		n += __builtin_popcount(m[y]);
+	}
+
+	return n;
+}
+
+/* Pixels differing between a and b, also stored into diff if not NULL */
+static inline u32_t lcd_matrix_diff(const u32_t a[LCD_HEIGHT], const u32_t b[LCD_HEIGHT], u32_t diff[LCD_HEIGHT])
+{
+	u32_t n = 0, d;
+	u8_t y;
+
+	for (y = 0; y < LCD_HEIGHT; y++) {
+		d = a[y] ^ b[y];
+		n += __builtin_popcount(d);
+		if (diff != NULL) {
+			diff[y] = d;
+		}
+	}
+
+	return n;
+}
+
+static inline bool_t lcd_matrix_equal(const u32_t a[LCD_HEIGHT], const u32_t b[LCD_HEIGHT])
+{
+	u32_t d = 0;
+	u8_t y;
+
+	for (y = 0; y < LCD_HEIGHT; y++) {
+		d |= a[y] ^ b[y];
+	}
+
+	return d == 0;
+}
+
+/* Smallest rectangle holding every lit pixel, returns 0 if the frame is blank */
+static inline bool_t lcd_matrix_bbox(const u32_t m[LCD_HEIGHT], lcd_rect_t *r)
+{
+	u32_t cols = 0;
+	int8_t y, y0 = -1, y1 = -1;
+
+	for (y = 0; y < LCD_HEIGHT; y++) {
+		if (m[y]) {
+			if (y0 < 0) {
+				y0 = y;
+			}
+			y1 = y;
+			cols |= m[y];
+		}
+	}
+
+	if (cols == 0) {
+		return 0;
+	}
+
+	r->x0 = __builtin_clz(cols);
+	r->x1 = 31 - __builtin_ctz(cols);
+	r->y0 = y0;
+	r->y1 = y1;
+	return 1;
+}
+
+#endif /* _LCD_MATRIX_H_ */
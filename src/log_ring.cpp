@@ -0,0 +1,136 @@
+// log_ring.cpp
+// KidsBar: bounded multi-producer / single-consumer ring (sequence-numbered slots),
+// producers claim a slot with one CAS, the drain task is the only consumer.
+#include "log_ring.h"
+
+#include <atomic>
+#include <stdarg.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+#ifndef LOG_LEVEL_DEFAULT
+#define LOG_LEVEL_DEFAULT LOG_LVL_INFO
+#endif
+
+volatile uint8_t g_logLevel = LOG_LEVEL_DEFAULT;
+
+struct LogSlot {
+  std::atomic<uint32_t> seq;
+  uint16_t len;
+  char msg[LOG_RING_MSG_LEN];
+};
+
+static LogSlot s_slots[LOG_RING_SLOTS];
+static std::atomic<uint32_t> s_head(0);  // next slot to claim (producers)
+static uint32_t s_tail = 0;              // next slot to print (drain task only)
+static std::atomic<uint32_t> s_dropped(0);
+
+static TaskHandle_t s_drainTaskHandle = nullptr;
+static const uint32_t LOG_DRAIN_PERIOD_MS = 20;
+
+static const char LEVEL_TAGS[] = { 'E', 'W', 'I', 'D' };
+
+// Slot i is free for position i on the first lap; done before setup() runs.
+static struct LogRingInit {
+  LogRingInit() {
+    for (uint32_t i = 0; i < LOG_RING_SLOTS; i++) {
+      s_slots[i].seq.store(i, std::memory_order_relaxed);
+    }
+  }
+} s_logRingInit;
+
+void logRingSetLevel(LogLevel level) {
+  g_logLevel = level;
+}
+
+bool logRingWriteV(LogLevel level, const char* fmt, va_list args) {
+  // Claim a slot: its sequence equals our position when it is free.
+  uint32_t pos = s_head.load(std::memory_order_relaxed);
+  LogSlot* slot;
+  for (;;) {
+    slot = &s_slots[pos & (LOG_RING_SLOTS - 1)];
+    int32_t diff = (int32_t)slot->seq.load(std::memory_order_acquire) - (int32_t)pos;
+    if (diff == 0) {
+      if (s_head.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) break;
+    } else if (diff < 0) {
+      s_dropped.fetch_add(1, std::memory_order_relaxed);
+      return false;
+    } else {
+      pos = s_head.load(std::memory_order_relaxed);
+    }
+  }
+
+  // Timestamp at write time, not at print time
+  int n = snprintf(slot->msg, sizeof(slot->msg), "%8lu %c ",
+                   (unsigned long)millis(), LEVEL_TAGS[level & 0x3]);
+  int m = vsnprintf(slot->msg + n, sizeof(slot->msg) - n, fmt, args);
+  if (m < 0) m = 0;
+  size_t len = (size_t)n + (size_t)m;
+  if (len > sizeof(slot->msg) - 1) len = sizeof(slot->msg) - 1;
+  slot->len = (uint16_t)len;
+
+  // Publish
+  slot->seq.store(pos + 1, std::memory_order_release);
+  return true;
+}
+
+bool logRingWrite(LogLevel level, const char* fmt, ...) {
+  va_list args;
+  va_start(args, fmt);
+  bool ok = logRingWriteV(level, fmt, args);
+  va_end(args);
+  return ok;
+}
+
+// Print one pending message; returns false when the ring is empty.
+static bool drainOne() {
+  LogSlot* slot = &s_slots[s_tail & (LOG_RING_SLOTS - 1)];
+  if (slot->seq.load(std::memory_order_acquire) != s_tail + 1) return false;
+
+  size_t len = slot->len;
+  // Strip a trailing newline, one is always appended
+  if (len > 0 && slot->msg[len - 1] == '\n') len--;
+  Serial.write((const uint8_t*)slot->msg, len);
+  Serial.write('\n');
+
+  // Hand the slot back to producers for the next lap
+  slot->seq.store(s_tail + LOG_RING_SLOTS, std::memory_order_release);
+  s_tail++;
+  return true;
+}
+
+static void logDrainTask(void* arg) {
+  (void)arg;
+  uint32_t reportedDrops = 0;
+
+  while (true) {
+    while (drainOne()) {}
+
+    uint32_t dropped = s_dropped.load(std::memory_order_relaxed);
+    if (dropped != reportedDrops) {
+      Serial.printf("[LOG] %lu message(s) dropped\n", (unsigned long)(dropped - reportedDrops));
+      reportedDrops = dropped;
+    }
+
+    vTaskDelay(pdMS_TO_TICKS(LOG_DRAIN_PERIOD_MS));
+  }
+}
+
+void logRingStartTask(uint8_t priority, uint8_t core) {
+  if (s_drainTaskHandle) return;
+  if (core > 1) core = 0;
+  xTaskCreatePinnedToCore(logDrainTask, "logDrain", 3072, nullptr, priority, &s_drainTaskHandle, core);
+}
+
+void logRingFlush() {
+  // Only safe when the drain task cannot run concurrently
+  if (s_drainTaskHandle) vTaskSuspend(s_drainTaskHandle);
+  while (drainOne()) {}
+  Serial.flush();
+  if (s_drainTaskHandle) vTaskResume(s_drainTaskHandle);
+}
+
+uint32_t logRingDropped() {
+  return s_dropped.load(std::memory_order_relaxed);
+}
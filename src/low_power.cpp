@@ -0,0 +1,260 @@
+// low_power.cpp
+// KidsBar: real-time pacing and sleep modes (see low_power.h).
+#include "low_power.h"
+
+#include <sys/time.h>
+#include <driver/gpio.h>
+#include <driver/rtc_io.h>
+#include <esp_rom_crc.h>
+#include <esp_sleep.h>
+#include <esp_system.h>
+#include <esp_timer.h>
+
+#include "config.h"
+#include "save_trigger.h"
+#include "rtc_state.h"
+#include "power_fail.h"
+#include "input_events.h"
+#include "buzzer.h"
+#include "log_ring.h"
+
+extern "C" {
+#include "hw.h"
+#include "lcd_history.h"
+}
+
+static const uint32_t LP_MAGIC = 0x534D4154;  // "TAMS"
+static const uint32_t TICKS_PER_SECOND = 32768;
+static const u32_t ACTIVE_AHEAD_TICKS = LOW_POWER_ACTIVE_AHEAD_MS * TICKS_PER_SECOND / 1000;
+
+// Wake pins (button and encoder)
+static const int WAKE_PINS[] = {ENC_SW_PIN, ENC_CLK_PIN, ENC_DT_PIN};
+
+// Survives deep sleep next to the state mirror (rtc_state.h)
+struct SleepInfo {
+  uint32_t magic;
+  uint32_t crc;        // CRC32 of everything after this field
+  int64_t sleptAtUs;   // RTC wall clock when going to sleep
+  uint32_t unsavedMs;  // How long the RAM has had changes flash does not have (0 = none)
+};
+RTC_NOINIT_ATTR static SleepInfo s_rtc;
+
+static bool s_started = false;
+static int64_t s_anchorUs = 0;
+static u32_t s_anchorTicks = 0;
+
+static u32_t s_seenEdges = 0;
+static u32_t s_seenLcd = 0;
+static uint32_t s_lastInputMs = 0;
+static uint32_t s_lastLcdMs = 0;
+
+// Set by lowPowerResume()
+static bool s_resumed = false;
+static bool s_wokeByInput = false;
+static bool s_lcdChangedAsleep = false;
+static uint32_t s_unsavedMs = 0;
+static uint32_t s_savesAtBegin = 0;
+
+static uint32_t sleepInfoCrc() {
+  const uint8_t* body = (const uint8_t*)&s_rtc.sleptAtUs;
+  return esp_rom_crc32_le(0, body, sizeof(s_rtc) - offsetof(SleepInfo, sleptAtUs));
+}
+
+// Keeps counting through deep sleep, unlike esp_timer
+static int64_t rtcNowUs() {
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  return (int64_t)tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+static u32_t wallTicks() {
+  return lowPowerTicksAt(esp_timer_get_time());
+}
+
+static uint32_t ticksToMs(u32_t ticks) {
+  return (uint32_t)((uint64_t)ticks * 1000 / TICKS_PER_SECOND);
+}
+
+static void trackActivity(uint32_t now) {
+  u32_t edges = hw_get_input_edges();
+  if (edges != s_seenEdges || inputButtonDown()) {
+    s_seenEdges = edges;
+    s_lastInputMs = now;
+  }
+
+  u32_t lcd = hw_get_lcd_changes();
+  if (lcd != s_seenLcd) {
+    s_seenLcd = lcd;
+    s_lastLcdMs = now;
+  }
+}
+
+// Wake on any level change of the encoder, a press, or the supply going away
+static void armGpioWake(int pin, bool armed) {
+  if (pin < 0) return;
+  if (!armed) {
+    gpio_wakeup_disable((gpio_num_t)pin);
+    return;
+  }
+  gpio_wakeup_enable((gpio_num_t)pin, digitalRead(pin) ? GPIO_INTR_LOW_LEVEL : GPIO_INTR_HIGH_LEVEL);
+}
+
+static void lightSleep(uint32_t ms) {
+  inputEventsSuspend();
+  for (int pin : WAKE_PINS) armGpioWake(pin, true);
+  armGpioWake(POWER_SENSE_PIN, true);
+  esp_sleep_enable_gpio_wakeup();
+  esp_sleep_enable_timer_wakeup((uint64_t)ms * 1000);
+
+  esp_light_sleep_start();
+
+  esp_sleep_disable_wakeup_source(ESP_SLEEP_WAKEUP_ALL);
+  for (int pin : WAKE_PINS) armGpioWake(pin, false);
+  armGpioWake(POWER_SENSE_PIN, false);
+  inputEventsResume();
+}
+
+static bool deepSleepDue(uint32_t now) {
+  if (now - s_lastInputMs < IDLE_SLEEP_TIMEOUT_MS || now - s_lastLcdMs < LOW_POWER_DEEP_QUIET_MS) {
+    return false;
+  }
+  return !saveStateBusy() && !powerFailPending();
+}
+
+bool lowPowerWoke() {
+  if (esp_reset_reason() != ESP_RST_DEEPSLEEP) return false;
+
+  // The wake pins are still routed to the RTC domain
+  for (int pin : WAKE_PINS) rtc_gpio_deinit((gpio_num_t)pin);
+
+  return s_rtc.magic == LP_MAGIC && s_rtc.crc == sleepInfoCrc() && rtcStateValid();
+}
+
+bool lowPowerResume() {
+  if (esp_reset_reason() != ESP_RST_DEEPSLEEP || s_rtc.magic != LP_MAGIC || s_rtc.crc != sleepInfoCrc()) {
+    return false;
+  }
+  s_rtc.magic = 0;  // One resume per sleep
+
+  int64_t sleptUs = rtcNowUs() - s_rtc.sleptAtUs;
+  if (sleptUs < 0) sleptUs = 0;
+  s_unsavedMs = s_rtc.unsavedMs + (uint32_t)(sleptUs / 1000);
+  s_wokeByInput = esp_sleep_get_wakeup_cause() == ESP_SLEEP_WAKEUP_EXT1;
+
+  // Emulate the time spent asleep at full speed
+  u32_t lcd = hw_get_lcd_changes();
+  u32_t target = (u32_t)(sleptUs * TICKS_PER_SECOND / 1000000);
+  u32_t start = cpu_get_ticks();
+  uint32_t steps = 0;
+  while (cpu_get_ticks() - start < target) {
+    if (cpu_step()) break;
+    if (++steps % 1000 == 0) yield();
+  }
+  s_lcdChangedAsleep = hw_get_lcd_changes() != lcd;
+  lcd_history_reset();  // No vsync ran during the catch-up
+  s_resumed = true;
+
+  KB_LOGI("[Power] Woke after %lu ms (%s), caught up in %lu steps", (unsigned long)(sleptUs / 1000),
+          s_wokeByInput ? "input" : "timer", (unsigned long)steps);
+  return true;
+}
+
+void lowPowerBegin() {
+  uint32_t now = millis();
+  s_seenEdges = hw_get_input_edges();
+  s_seenLcd = hw_get_lcd_changes();
+  s_lastInputMs = now;
+  s_lastLcdMs = now;
+  s_savesAtBegin = saveTriggerTotal();
+
+  // A timer wake with nothing new on the LCD goes straight back to deep sleep
+  if (s_resumed && !s_wokeByInput) {
+    s_lastInputMs = now - IDLE_SLEEP_TIMEOUT_MS;
+    if (!s_lcdChangedAsleep) s_lastLcdMs = now - LOW_POWER_DEEP_QUIET_MS;
+  }
+
+  lowPowerResync();
+  s_started = true;
+}
+
+void lowPowerResync() {
+  s_anchorUs = esp_timer_get_time();
+  s_anchorTicks = cpu_get_ticks();
+}
+
+u32_t lowPowerTicksAt(int64_t us) {
+  if (!s_started) return cpu_get_ticks();
+  return s_anchorTicks + (u32_t)((us - s_anchorUs) * TICKS_PER_SECOND / 1000000);
+}
+
+int64_t lowPowerUsAt(u32_t ticks) {
+  if (!s_started) return esp_timer_get_time();
+  return s_anchorUs + (int64_t)(int32_t)(ticks - s_anchorTicks) * 1000000 / TICKS_PER_SECOND;
+}
+
+bool lowPowerPoll() {
+#if LOW_POWER_ENABLED
+  if (!s_started) return false;
+  uint32_t now = millis();
+  trackActivity(now);
+
+  // Behind real time (E-ink refresh, after a sleep): catch up at full speed
+  int32_t ahead = (int32_t)(cpu_get_ticks() - wallTicks());
+  if (ahead <= 0) return false;
+
+  if (now - s_lastInputMs < LOW_POWER_IDLE_MS) {
+    if ((u32_t)ahead >= ACTIVE_AHEAD_TICKS) delay(ticksToMs(ahead));
+    return false;
+  }
+
+  if (deepSleepDue(now)) return true;
+
+  // Idle: nothing new reaches the LCD before the next timer interrupt. The ROM keeps
+  // its programmable timer ticking at ~37 Hz, so wake at most every LOW_POWER_IDLE_SLICE_MS.
+  uint32_t ms = ticksToMs(ahead + cpu_get_ticks_to_next_event());
+  if (ms < LOW_POWER_IDLE_SLICE_MS) ms = LOW_POWER_IDLE_SLICE_MS;
+  // LEDC stops in light sleep: stay awake while the buzzer sounds
+  if (LOW_POWER_LIGHT_SLEEP && ms >= LOW_POWER_LIGHT_MIN_MS && !saveStateBusy() && !powerFailPending() &&
+      !buzzerBusy()) {
+    lightSleep(ms);
+  } else if (ms) {
+    // Inputs are captured meanwhile but only reach the ROM between waits: keep them short
+    delay(ms < LOW_POWER_ACTIVE_AHEAD_MS ? ms : LOW_POWER_ACTIVE_AHEAD_MS);
+  }
+#endif
+  return false;
+}
+
+void lowPowerDeepSleep(cpu_state_t* state) {
+  // Flash only needs the state once enough changed or the flash copy got old
+  if (saveTriggerTotal() != s_savesAtBegin) s_unsavedMs = 0;
+  uint16_t dirty = saveTriggerDirtyNibbles();
+  uint32_t unsaved = (s_unsavedMs || dirty) ? s_unsavedMs + saveTriggerSinceSaveMs() : 0;
+  if (unsaved && (dirty >= SAVE_DIRTY_NIBBLES || unsaved >= SAVE_MAX_AGE_MS)) {
+    saveTriggerNow(SAVE_REASON_SLEEP);
+    unsaved = 0;
+  }
+
+  rtcStateStore(state);
+  s_rtc.unsavedMs = unsaved;
+  s_rtc.sleptAtUs = rtcNowUs();
+  s_rtc.crc = sleepInfoCrc();
+  s_rtc.magic = LP_MAGIC;
+
+  // Wake when a pin that is high now goes low (button press, encoder turn)
+  uint64_t mask = 0;
+  for (int pin : WAKE_PINS) {
+    if (digitalRead(pin) != HIGH) continue;
+    mask |= 1ULL << pin;
+    rtc_gpio_pullup_en((gpio_num_t)pin);
+    rtc_gpio_pulldown_dis((gpio_num_t)pin);
+  }
+  if (mask) esp_sleep_enable_ext1_wakeup(mask, ESP_EXT1_WAKEUP_ANY_LOW);
+  esp_sleep_pd_config(ESP_PD_DOMAIN_RTC_PERIPH, ESP_PD_OPTION_ON);  // Keep the pull-ups
+  esp_sleep_enable_timer_wakeup((uint64_t)LOW_POWER_DEEP_SLEEP_S * 1000000ULL);
+
+  KB_LOGI("[Power] Deep sleep for %u s (unsaved for %lu s)", LOW_POWER_DEEP_SLEEP_S,
+          (unsigned long)(unsaved / 1000));
+  logRingFlush();
+  esp_deep_sleep_start();
+}
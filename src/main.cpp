@@ -11,16 +11,31 @@
 
 #include "config.h"
 #include "encoder_pcnt.h"
+#include "input_events.h"
+#include "gestures.h"
+#include "buzzer.h"
 #include "led_status.h"
+#include "log_ring.h"
 #include "bitmaps.h"
 
 extern "C" {
   #include "tamalib.h"
   #include "hw.h"
   #include "hal.h"
+  #include "lcd_history.h"
+  #include "lcd_matrix.h"
+#ifdef ENABLE_BUZZER_TRACE
+  #include "buzzer_trace.h"
+#endif
 }
 
 #include "savestate.h"
+#include "save_trigger.h"
+#include "save_slots.h"
+#include "rewind.h"
+#include "power_fail.h"
+#include "low_power.h"
+#include "rtc_state.h"
 
 // ==================== HARDWARE ====================
 
@@ -32,29 +47,61 @@ GxEPD2_BW<GxEPD2_290_BS, GxEPD2_290_BS::HEIGHT> display(
 
 // Tamagotchi state
 static cpu_state_t g_cpu_state;
-static bool_t g_matrix[LCD_HEIGHT][LCD_WIDTH/8] = {{0}};
-static bool_t g_icons[ICON_NUM] = {0};
+static u32_t g_matrix[LCD_HEIGHT] = {0};  // One row per word, see LCD_ROW_BIT()
+static u32_t g_ghost[LCD_HEIGHT] = {0};   // Pixels only lit between two refreshes
+static u8_t g_icons = 0;                  // Bit n = icon n
 
-// Encoder input state
-volatile int g_encStepAccum = 0;
-portMUX_TYPE g_encMux = portMUX_INITIALIZER_UNLOCKED;
+// What is currently on the E-ink, to only refresh the changed area
+static u32_t g_drawnMatrix[LCD_HEIGHT] = {0};
+static u32_t g_drawnGhost[LCD_HEIGHT] = {0};
+static u8_t g_drawnIcons = 0;
+static bool g_drawnValid = false;
 
-// Button state - use int to allow -1 for "none"
-static int g_currentBtn = -1;  // -1 = none, 0 = BTN_LEFT, 1 = BTN_MIDDLE, 2 = BTN_RIGHT
-static unsigned long g_lastBtnTime = 0;
+// ==================== BOOT TIMING ====================
 
-// Auto-save
-static unsigned long g_lastSave = 0;
-#define AUTO_SAVE_INTERVAL_MS (5 * 60 * 1000UL)
+// Boot time breakdown (ms), logged once when the first frame is on screen
+struct BootTimes {
+  uint32_t serial, resume, storage, display, encoder, led, splash, load, warmup, services, firstFrame;
+};
+static BootTimes g_boot = {};
+static uint32_t g_bootMark = 0;
+static bool g_bootLogged = false;
+
+// Time since the previous mark
+static uint32_t bootLap() {
+  uint32_t now = millis();
+  uint32_t lap = now - g_bootMark;
+  g_bootMark = now;
+  return lap;
+}
+
+static void logBootTimes() {
+  g_boot.firstFrame = bootLap();
+  g_bootLogged = true;
+  KB_LOGI("Boot %lu ms: serial %lu, resume %lu, storage %lu, display %lu, encoder %lu, LED %lu, "
+          "splash %lu, load %lu, warm-up %lu, services %lu, first frame %lu", (unsigned long)millis(),
+          (unsigned long)g_boot.serial, (unsigned long)g_boot.resume, (unsigned long)g_boot.storage,
+          (unsigned long)g_boot.display,
+          (unsigned long)g_boot.encoder, (unsigned long)g_boot.led, (unsigned long)g_boot.splash,
+          (unsigned long)g_boot.load, (unsigned long)g_boot.warmup, (unsigned long)g_boot.services,
+          (unsigned long)g_boot.firstFrame);
+}
 
 // ==================== HAL IMPLEMENTATION ====================
 
 static void hal_halt(void) {
-  Serial.println(F("HALT"));
+  KB_LOGD("HALT");
 }
 
 static void hal_log(log_level_t level, char *msg, ...) {
-  // Silent
+  LogLevel lvl = (level & LOG_ERROR) ? LOG_LVL_ERROR :
+                 (level & LOG_INFO)  ? LOG_LVL_INFO  : LOG_LVL_DEBUG;
+  if (!logRingEnabled(lvl)) return;
+
+  va_list args;
+  va_start(args, msg);
+  logRingWriteV(lvl, msg, args);
+  va_end(args);
 }
 
 static void hal_sleep_until(timestamp_t ts) {
@@ -66,47 +113,22 @@ static timestamp_t hal_get_timestamp(void) {
   return millis();
 }
 
-static void hal_set_lcd_matrix(u8_t x, u8_t y, bool_t val) {
-  // Buffer pixel changes - will be rendered on next update_screen()
-  static uint32_t call_count = 0;
-  if (call_count < 10) {
-    Serial.printf("set_lcd_matrix called: x=%u, y=%u, val=%u\n", x, y, val);
-    call_count++;
-  }
-
-  if (x >= LCD_WIDTH || y >= LCD_HEIGHT) return;
-
-  uint8_t byte_idx = x / 8;
-  uint8_t bit_idx = x % 8;
-  uint8_t mask = 0x80 >> bit_idx;
-
-  if (val) {
-    g_matrix[y][byte_idx] |= mask;
-  } else {
-    g_matrix[y][byte_idx] &= ~mask;
-  }
-}
-
-static void hal_set_lcd_icon(u8_t icon, bool_t val) {
-  if (icon < ICON_NUM) {
-    g_icons[icon] = val;
-  }
-}
-
 static void hal_set_frequency(u32_t freq) {
-  // No sound yet
+  buzzerSetFrequency(freq);
+#ifdef ENABLE_BUZZER_TRACE
+  buzzer_trace_set_frequency(freq);
+#endif
 }
 
 static void hal_play_frequency(bool_t en) {
-  // No sound yet
+  buzzerPlay(en);
+#ifdef ENABLE_BUZZER_TRACE
+  buzzer_trace_play(en);
+#endif
 }
 
 static int hal_handler(void) {
-  // Update button state for TamaLib
-  hw_set_button(BTN_LEFT,   g_currentBtn == (int)BTN_LEFT   ? BTN_STATE_PRESSED : BTN_STATE_RELEASED);
-  hw_set_button(BTN_MIDDLE, g_currentBtn == (int)BTN_MIDDLE ? BTN_STATE_PRESSED : BTN_STATE_RELEASED);
-  hw_set_button(BTN_RIGHT,  g_currentBtn == (int)BTN_RIGHT  ? BTN_STATE_PRESSED : BTN_STATE_RELEASED);
-
+  // Buttons reach TamaLib through hw_queue_button() (see INPUT)
   return 0; // Continue
 }
 
@@ -115,24 +137,49 @@ static void hal_update_screen(void) {
   // This is called by TamaLib when enough time has elapsed (based on framerate)
   static uint32_t update_count = 0;
 
-  // Count pixels in buffer
-  uint16_t pixel_count = 0;
-  for (uint8_t y = 0; y < LCD_HEIGHT; y++) {
-    for (uint8_t x = 0; x < LCD_WIDTH/8; x++) {
-      uint8_t byte_val = g_matrix[y][x];
-      for (uint8_t bit = 0; bit < 8; bit++) {
-        if (byte_val & (0x80 >> bit)) pixel_count++;
-      }
+  // Power is going away: the emergency save needs the loop back quickly
+  if (powerFailPending()) return;
+
+  // Compose the frame from the LCD history since the previous refresh
+  lcd_history_render(EMU_RENDER_POLICY, g_matrix, g_ghost, &g_icons);
+
+  // Only push the area that changed since the last refresh
+  int16_t win_x = 0, win_y = 0, win_w = display.width(), win_h = display.height();
+  if (g_drawnValid && g_icons == g_drawnIcons) {
+    u32_t diff[LCD_HEIGHT], ghost_diff[LCD_HEIGHT];
+    lcd_rect_t rect;
+
+    lcd_matrix_diff(g_matrix, g_drawnMatrix, diff);
+    lcd_matrix_diff(g_ghost, g_drawnGhost, ghost_diff);
+    for (uint8_t y = 0; y < LCD_HEIGHT; y++) {
+      diff[y] |= ghost_diff[y];
     }
-  }
 
-  Serial.printf("Screen update #%u, pixels=%u, icons=[", ++update_count, pixel_count);
-  for (uint8_t i = 0; i < 8; i++) {
-    Serial.printf("%d", g_icons[i] ? 1 : 0);
+    if (!lcd_matrix_bbox(diff, &rect)) {
+      return;  // Nothing visible changed
+    }
+    win_x = 16 + rect.x0 * 3;
+    win_y = 20 + rect.y0 * 3;
+    win_w = (rect.x1 - rect.x0 + 1) * 3;
+    win_h = (rect.y1 - rect.y0 + 1) * 3;
+  }
+  memcpy(g_drawnMatrix, g_matrix, sizeof(g_drawnMatrix));
+  memcpy(g_drawnGhost, g_ghost, sizeof(g_drawnGhost));
+  g_drawnIcons = g_icons;
+  g_drawnValid = true;
+
+  update_count++;
+  if (logRingEnabled(LOG_LVL_DEBUG)) {
+    char icons[ICON_NUM + 1];
+    for (uint8_t i = 0; i < ICON_NUM; i++) {
+      icons[i] = ((g_icons >> i) & 1) ? '1' : '0';
+    }
+    icons[ICON_NUM] = '\0';
+    KB_LOGD("Screen update #%u, pixels=%u, icons=[%s], window=%dx%d@%d,%d", update_count,
+            lcd_matrix_popcount(g_matrix), icons, win_w, win_h, win_x, win_y);
   }
-  Serial.println("]");
 
-  display.setPartialWindow(0, 0, display.width(), display.height());
+  display.setPartialWindow(win_x, win_y, win_w, win_h);
   display.firstPage();
   do {
     display.fillScreen(GxEPD_WHITE);
@@ -140,14 +187,13 @@ static void hal_update_screen(void) {
     // Draw Tamagotchi LCD (32x16 pixels, scaled 3x = 96x48)
     for (uint8_t y = 0; y < LCD_HEIGHT; y++) {
       for (uint8_t x = 0; x < LCD_WIDTH; x++) {
-        uint8_t byte_idx = x / 8;
-        uint8_t bit_idx = x % 8;
-        uint8_t mask = 0x80 >> bit_idx;
-
-        if (g_matrix[y][byte_idx] & mask) {
+        if (g_matrix[y] & LCD_ROW_BIT(x)) {
           int16_t screen_x = 16 + (x * 3);
           int16_t screen_y = 20 + (y * 3);
           display.fillRect(screen_x, screen_y, 3, 3, GxEPD_BLACK);
+        } else if (g_ghost[y] & LCD_ROW_BIT(x)) {
+          // Intermediate animation frame: single center dot
+          display.drawPixel(16 + (x * 3) + 1, 20 + (y * 3) + 1, GxEPD_BLACK);
         }
       }
     }
@@ -158,7 +204,7 @@ static void hal_update_screen(void) {
       int16_t icon_y = 90;
 
       // Selection triangle
-      if (g_icons[i]) {
+      if (g_icons & (1 << i)) {
         display.drawLine(icon_x + 6, icon_y + 1, icon_x + 10, icon_y + 1, GxEPD_BLACK);
         display.drawLine(icon_x + 7, icon_y + 2, icon_x + 9,  icon_y + 2, GxEPD_BLACK);
         display.drawPixel(icon_x + 8, icon_y + 3, GxEPD_BLACK);
@@ -168,6 +214,8 @@ static void hal_update_screen(void) {
       display.drawBitmap(icon_x, icon_y + 6, bitmaps + i * 18, 16, 9, GxEPD_BLACK);
     }
   } while (display.nextPage());
+
+  if (!g_bootLogged) logBootTimes();
 }
 
 static hal_t g_hal_impl = {
@@ -176,8 +224,6 @@ static hal_t g_hal_impl = {
   .sleep_until = &hal_sleep_until,
   .get_timestamp = &hal_get_timestamp,
   .update_screen = &hal_update_screen,
-  .set_lcd_matrix = &hal_set_lcd_matrix,
-  .set_lcd_icon = &hal_set_lcd_icon,
   .set_frequency = &hal_set_frequency,
   .play_frequency = &hal_play_frequency,
   .handler = &hal_handler,
@@ -185,162 +231,457 @@ static hal_t g_hal_impl = {
 
 hal_t *g_hal = &g_hal_impl;
 
-// ==================== INPUT ====================
+#ifdef ENABLE_BUZZER_TRACE
+// Recorded tone changes as "BZ <ticks> <freq> <on>" lines, to diff against a host run
+static void dumpBuzzerTrace() {
+  static u32_t reportedDrops = 0;
+  buzzer_change_t changes[8];
+  char line[32];
+  u32_t n;
+
+  while ((n = buzzer_trace_read(changes, 8)) != 0) {
+    for (u32_t i = 0; i < n; i++) {
+      buzzer_trace_format(&changes[i], line, sizeof(line));
+      Serial.print(F("BZ "));
+      Serial.print(line);
+    }
+  }
+  if (buzzer_trace_dropped() != reportedDrops) {
+    Serial.printf("BZ %lu change(s) dropped\n", (unsigned long)(buzzer_trace_dropped() - reportedDrops));
+    reportedDrops = buzzer_trace_dropped();
+  }
+}
+#endif
 
-void updateInput() {
-  unsigned long now = millis();
+// ==================== SAVE SLOT MENUS ====================
 
-  // Debounce
-  if (now - g_lastBtnTime < 50) {
-    return;
+static const uint8_t SLOT_LABEL_LEN = SAVE_SLOT_NAME_LEN + 7;  // Name + " (new)"
+
+static void drawMenu(const char* title, const char* const* items, uint8_t count, uint8_t sel) {
+  display.setPartialWindow(0, 0, display.width(), display.height());
+  display.firstPage();
+  do {
+    display.fillScreen(GxEPD_WHITE);
+    display.setFont();
+    display.setCursor(16, 8);
+    display.print(title);
+
+    for (uint8_t i = 0; i < count; i++) {
+      int16_t y = 28 + i * 20;
+      if (i == sel) {
+        display.setCursor(16, y);
+        display.print('>');
+      }
+      display.setCursor(28, y);
+      display.print(items[i]);
+    }
+  } while (display.nextPage());
+}
+
+// Wait for the button to be up and drop what the menu did not consume, so the
+// confirming press never reaches the game or the next menu
+static void menuDone() {
+  InputEvent ev;
+  while (inputButtonDown()) {
+    delay(10);
+    if (inputEventPeek(&ev)) inputEventConsume();  // Also notices a release inside the bounce window
   }
+  inputEventsClear();
+}
+
+// Turn to choose, press to confirm. The press that opened the menu may still be
+// down: only a new one confirms. Returns -1 after SAVE_PICKER_TIMEOUT_MS idle.
+static int menuChoose(const char* title, const char* const* items, uint8_t count, uint8_t sel) {
+  drawMenu(title, items, count, sel);
+
+  InputEvent ev;
+  unsigned long lastInput = millis();
+  bool confirmed = false;
+  while (!confirmed && millis() - lastInput < SAVE_PICKER_TIMEOUT_MS) {
+    int steps = 0;
+    while (inputEventPeek(&ev)) {
+      inputEventConsume();
+      if (ev.type == INPUT_EVENT_CW) steps++;
+      else if (ev.type == INPUT_EVENT_CCW) steps--;
+      else if (ev.type == INPUT_EVENT_PRESS) confirmed = true;
+    }
 
-  // Read encoder rotation
-  int steps = 0;
-  portENTER_CRITICAL(&g_encMux);
-  steps = g_encStepAccum;
-  g_encStepAccum = 0;
-  portEXIT_CRITICAL(&g_encMux);
-
-  if (steps > 0) {
-    g_currentBtn = (int)BTN_RIGHT;
-    g_lastBtnTime = now;
-  } else if (steps < 0) {
-    g_currentBtn = (int)BTN_LEFT;
-    g_lastBtnTime = now;
+    if (steps != 0 && !confirmed) {
+      sel = (sel + count + (steps > 0 ? 1 : -1)) % count;
+      drawMenu(title, items, count, sel);
+      lastInput = millis();
+    }
+    delay(10);
   }
 
-  // Read encoder button
-  static bool lastSw = HIGH;
-  bool sw = digitalRead(ENC_SW_PIN);
+  menuDone();
+  return confirmed ? sel : -1;
+}
 
-  if (!sw && lastSw) {
-    g_currentBtn = (int)BTN_MIDDLE;
-    g_lastBtnTime = now;
+// Slot names, with empty slots marked
+static void slotLabels(char labels[][SLOT_LABEL_LEN], const char** items) {
+  for (uint8_t i = 0; i < SAVE_SLOT_COUNT; i++) {
+    snprintf(labels[i], SLOT_LABEL_LEN, "%s%s", saveSlotName(i), saveSlotUsed(i) ? "" : " (new)");
+    items[i] = labels[i];
   }
-  lastSw = sw;
+}
 
-  // Clear button after debounce
-  if (now - g_lastBtnTime > 50) {
-    g_currentBtn = -1;  // None
+// Shown at boot while the encoder button is held.
+// Keeps the current slot if nothing happens for SAVE_PICKER_TIMEOUT_MS.
+static uint8_t pickSaveSlot() {
+  char labels[SAVE_SLOT_COUNT][SLOT_LABEL_LEN];
+  const char* items[SAVE_SLOT_COUNT];
+  slotLabels(labels, items);
+  int sel = menuChoose("Choose a save:", items, SAVE_SLOT_COUNT, saveSlotActive());
+  return sel < 0 ? saveSlotActive() : (uint8_t)sel;
+}
+
+static void drawNameEditor(uint8_t slot, const char* name, uint8_t pos) {
+  display.setPartialWindow(0, 0, display.width(), display.height());
+  display.firstPage();
+  do {
+    display.fillScreen(GxEPD_WHITE);
+    display.setFont();
+    display.setCursor(16, 8);
+    display.printf("Name for slot %u:", slot + 1);
+    display.setCursor(16, 40);
+    display.print(name);
+    if (!name[pos]) display.print('<');  // End of name: a press here finishes
+    display.drawLine(16 + pos * 6, 50, 20 + pos * 6, 50, GxEPD_BLACK);
+    display.setCursor(16, 72);
+    display.print(F("Turn: letter  Press: next"));
+  } while (display.nextPage());
+}
+
+// Turn to change the character under the cursor, press to move on. Choosing the
+// end mark ('<') and pressing finishes; a time-out keeps the old name.
+static void editSlotName(uint8_t slot) {
+  const uint8_t choices = strlen(SAVE_SLOT_NAME_CHARSET) + 1;  // Last one = end of name
+  char name[SAVE_SLOT_NAME_LEN + 1] = {};
+  strncpy(name, saveSlotName(slot), SAVE_SLOT_NAME_LEN);
+  uint8_t pos = 0;
+  drawNameEditor(slot, name, pos);
+
+  InputEvent ev;
+  unsigned long lastInput = millis();
+  bool done = false;
+  while (!done && millis() - lastInput < SAVE_PICKER_TIMEOUT_MS) {
+    int steps = 0;
+    bool next = false;
+    while (!next && inputEventPeek(&ev)) {
+      inputEventConsume();
+      if (ev.type == INPUT_EVENT_CW) steps++;
+      else if (ev.type == INPUT_EVENT_CCW) steps--;
+      else if (ev.type == INPUT_EVENT_PRESS) next = true;
+    }
+
+    if (steps != 0) {
+      const char* at = name[pos] ? strchr(SAVE_SLOT_NAME_CHARSET, name[pos]) : nullptr;
+      int c = at ? at - SAVE_SLOT_NAME_CHARSET : choices - 1;
+      c = ((c + steps) % choices + choices) % choices;
+      if (c == choices - 1) {
+        memset(name + pos, 0, sizeof(name) - pos);
+      } else {
+        name[pos] = SAVE_SLOT_NAME_CHARSET[c];
+      }
+    }
+    if (next) {
+      if (!name[pos] || ++pos == SAVE_SLOT_NAME_LEN) done = true;
+    }
+    if (steps != 0 || next) {
+      if (!done) drawNameEditor(slot, name, pos);
+      lastInput = millis();
+    }
+    delay(10);
+  }
+
+  menuDone();
+  if (done && saveSlotSetName(slot, name)) {
+    KB_LOGI("[Slots] Slot %u renamed \"%s\"", slot, saveSlotName(slot));
   }
 }
 
+// Leave the running game in its slot and continue with `slot` (a new game if empty)
+static void switchSlot(uint8_t slot) {
+  saveSlotSnapshot(&g_cpu_state, saveSlotActive());
+  bool loaded = saveSlotRestore(&g_cpu_state, slot);
+  saveSlotSetActive(slot);
+  if (!loaded && !(validEEPROM() && loadStateFromEEPROM(&g_cpu_state))) {
+    cpu_reset();
+    lcd_history_reset();
+  }
+
+  cpu_refresh_hw();
+  hw_clear_inputs();
+  rewindReset();                    // The history belongs to the other game
+  saveTriggerBegin(&g_cpu_state);   // What was loaded is what is saved
+}
+
+// Save slots while playing: switch game, snapshot the running game into a slot,
+// rename a slot. The game is paused meanwhile.
+static void runSlotMenu() {
+  static const char* const ACTIONS[] = {"Play this slot", "Save game here", "Rename", "Back"};
+  char labels[SAVE_SLOT_COUNT][SLOT_LABEL_LEN];
+  const char* items[SAVE_SLOT_COUNT];
+  slotLabels(labels, items);
+
+  int slot = menuChoose("Save slots:", items, SAVE_SLOT_COUNT, saveSlotActive());
+  if (slot >= 0) {
+    switch (menuChoose(saveSlotName(slot), ACTIONS, 4, 0)) {
+      case 0:
+        if (slot != saveSlotActive()) switchSlot(slot);
+        break;
+      case 1:
+        saveSlotSnapshot(&g_cpu_state, slot);
+        break;
+      case 2:
+        editSlotName(slot);
+        break;
+      default:
+        break;
+    }
+  }
+
+  // Back to the game: its screen is redrawn whole, pacing restarts from now
+  gesturesReset();
+  lowPowerResync();
+  g_drawnValid = false;
+  hal_update_screen();
+}
+
+// ==================== INPUT ====================
+
+// Gestures that act on the emulator rather than on the game's buttons
+static void runGestureAction(GestureAction action) {
+  switch (action) {
+    case GESTURE_REWIND:
+      if (rewindRestore(&g_cpu_state, GESTURE_REWIND_BACK)) {
+        gesturesReset();
+        cpu_refresh_hw();
+        lowPowerResync();  // The emulated clock jumped back
+        KB_LOGI("Rewound %u s", GESTURE_REWIND_BACK);
+      }
+      break;
+    case GESTURE_SLOTS:
+      runSlotMenu();
+      break;
+    case GESTURE_RESET:
+      logRingFlush();
+      Serial.println(F("RESET"));
+      eraseStateFromEEPROM();
+      rtcStateClear();  // Otherwise the restart resumes the erased game
+      ESP.restart();
+      break;
+    default:
+      break;
+  }
+}
+
+// ==================== RECOVERY ====================
+
+// The core stopped on a state it cannot run (cpu_step() logged the PC). Go back to
+// the last save; if that one stops again before anything newer was saved, it is
+// the culprit and the game starts over.
+static void recoverCore() {
+  static uint32_t savesAtRecovery = UINT32_MAX;
+
+  cpu_get_state(&g_cpu_state);
+  uint16_t pc = g_cpu_state.pc;
+  uint32_t saves = saveTriggerTotal();
+  bool loaded = saves != savesAtRecovery && validEEPROM() && loadStateFromEEPROM(&g_cpu_state);
+  savesAtRecovery = saves;
+  if (!loaded) {
+    cpu_reset();
+    lcd_history_reset();
+  }
+  KB_LOGE("Emulator stopped at PC 0x%04X, %s", pc, loaded ? "last save reloaded" : "game restarted");
+
+  cpu_refresh_hw();
+  hw_clear_inputs();
+  gesturesReset();
+  rewindReset();                   // The history may lead to the same state
+  saveTriggerBegin(&g_cpu_state);
+  rtcStateStore(&g_cpu_state);     // A restart must not resume the stopped state
+  lowPowerResync();
+  tamalib_set_exec_mode(EXEC_MODE_RUN);
+}
+
+// ==================== EMULATION ====================
+
+// One batch of instructions, up to LOOP_BATCH_TICKS. It stops at the next queued
+// button change (applied by the caller before the following batch) and when the
+// core stops. Runs at least one instruction.
+static void runBatch() {
+  u32_t end = cpu_get_ticks() + LOOP_BATCH_TICKS;
+  u32_t next;
+  if (hw_next_input_tick(&next) && (int32_t)(next - end) < 0) end = next;
+
+  do {
+    tamalib_mainloop_step_by_step();
+  } while ((int32_t)(cpu_get_ticks() - end) < 0 && tamalib_get_exec_mode() == EXEC_MODE_RUN);
+}
+
 // ==================== SETUP ====================
 
 void setup() {
+  // Deep-sleep wakes skip everything that is only there for a human watching
+  bool woke = lowPowerWoke();
+
   Serial.begin(115200);
-  delay(500);
+  if (!woke) delay(500);
+  logRingStartTask(1, 0);
+  g_boot.serial = bootLap();
 
   Serial.println(F("\n=== KidsBar Tamagotchi ===\n"));
 
+  // Init TamaLib
+  tamalib_register_hal(g_hal);
+  tamalib_init(1000); // ts_freq = 1000 (milliseconds)
+  tamalib_set_adaptive_framerate(EMU_FPS_MAX, EMU_IDLE_REFRESH_S); // E-ink: refresh on LCD activity only
+
+  // Deep-sleep wake or soft reset: the RTC mirror is newer than any save and needs no flash
+  bool restored = rtcStateRestore(&g_cpu_state);
+  if (restored) {
+    cpu_refresh_hw();
+    lowPowerResume();  // Emulate the time spent in deep sleep
+  }
+  g_boot.resume = bootLap();
+
+  // Init storage: a restored game skips the splash and the warm-up
+  initEEPROM();
+  powerFailRecover();
+  saveSlotsBegin();
+  if (restored && rtcStateRestoredSlot() != saveSlotActive()) {
+    // The mirror is of another game than the active slot: load the slot instead
+    KB_LOGW("RTC state is for slot %d, active slot is %u", rtcStateRestoredSlot(), saveSlotActive());
+    restored = false;
+  }
+  g_boot.storage = bootLap();
+
   // Init display
-  display.init(115200);
+  display.init(115200, !woke);  // No full refresh on wake: the E-ink still shows the game
   display.setRotation(1);
   display.setTextColor(GxEPD_BLACK);
+  g_boot.display = bootLap();
 
-  // Welcome
-  display.setFullWindow();
-  display.firstPage();
-  do {
-    display.fillScreen(GxEPD_WHITE);
-    display.setFont();
-    display.setCursor(60, 60);
-    display.print(F("Tamagotchi"));
-  } while (display.nextPage());
-
-  // Init encoder
+  // Init encoder and button (interrupt-driven from here on)
+  inputEventsBegin(ENC_SW_PIN);
   encoderPcntBegin(ENC_CLK_PIN, ENC_DT_PIN);
-  pinMode(ENC_SW_PIN, INPUT_PULLUP);
+  g_boot.encoder = bootLap();
 
   // Init LED
   ledStatusBegin(NEOPIXEL_PIN, NEOPIXEL_COUNT, BOARD_RGB_PIN, BOARD_RGB_COUNT);
   ledStatusSetMasterBrightness(0.3);
-  setLed(0, 255, 0);
-
-  // Init TamaLib
-  tamalib_register_hal(g_hal);
-  tamalib_init(1000); // ts_freq = 1000 (milliseconds)
-  tamalib_set_framerate(1); // 1 FPS for E-ink
-
-  // Init storage
-  initEEPROM();
+  if (!woke) setLed(0, 255, 0);
+  g_boot.led = bootLap();
+
+  // Hold the encoder button while powering on to pick another save slot
+  if (!woke && inputButtonDown()) {
+    uint8_t slot = pickSaveSlot();
+    saveSlotSetActive(slot);
+    Serial.printf("Save slot %u \"%s\"\n", slot, saveSlotName(slot));
+    restored = false;  // The picked slot comes from flash
+    bootLap();  // Waiting for the user is not boot time
+  }
 
   // Load state (these functions call cpu_set_state internally)
-  if (validEEPROM()) {
-    Serial.println(F("Loading saved state..."));
-    loadStateFromEEPROM(&g_cpu_state);
-    // CRITICAL: Refresh hardware to trigger display update callbacks
-    Serial.println(F("Refreshing display hardware..."));
+  if (!restored && validEEPROM() && loadStateFromEEPROM(&g_cpu_state)) {
+    // Mid-execution snapshot: refresh the display RAM views and go straight to the loop
     cpu_refresh_hw();
-    Serial.println(F("Display hardware refreshed"));
-  } else {
+    restored = true;
+  }
+  if (!restored) {
+    // Welcome (the first game frame replaces it on restored boots)
+    display.setFullWindow();
+    display.firstPage();
+    do {
+      display.fillScreen(GxEPD_WHITE);
+      display.setFont();
+      display.setCursor(60, 60);
+      display.print(F("Tamagotchi"));
+    } while (display.nextPage());
+    g_boot.splash = bootLap();
+
     // For new Tamagotchi, do a complete CPU reset to start from boot code (PC=0x0100)
     // instead of using hardcoded mid-execution state
     Serial.println(F("New Tamagotchi - resetting CPU to boot..."));
     cpu_reset();
-    Serial.println(F("CPU reset complete - starting from PC=0x0100"));
   }
+  g_boot.load = bootLap();
+
+  if (!restored) {
+    // Cold start: let the ROM initialize and take its first clock interrupts,
+    // bounded in emulated ticks rather than wall time
+    u32_t start_ticks = cpu_get_ticks();
+    uint32_t step_count = 0;
+    while (cpu_get_ticks() - start_ticks < BOOT_WARMUP_TICKS) {
+      int result = cpu_step();
+      if (result != 0) {
+        Serial.printf("CPU halted at step %u (result=%d)\n", step_count, result);
+        break;
+      }
+      step_count++;
 
-  // Run CPU for 3 seconds of real time to allow initialization and first clock interrupt
-  Serial.println(F("Running CPU for 3 seconds to trigger clock interrupts..."));
-  unsigned long start_time = millis();
-  uint32_t step_count = 0;
-  while (millis() - start_time < 3000) {
-    int result = cpu_step();
-    if (result != 0) {
-      Serial.printf("CPU halted at step %u (result=%d)\n", step_count, result);
-      break;
-    }
-    step_count++;
-
-    // Yield occasionally to allow other tasks
-    if (step_count % 1000 == 0) {
-      yield();
+      // Yield occasionally to allow other tasks
+      if (step_count % 1000 == 0) {
+        yield();
+      }
     }
+    g_boot.warmup = bootLap();
+    Serial.printf("Warm-up: %u steps in %lu ms\n", step_count, (unsigned long)g_boot.warmup);
   }
-  Serial.printf("CPU ran for %lu ms, executed %u steps\n", millis() - start_time, step_count);
+
+  // Saves are triggered by changes from here on
+  saveTriggerBegin(&g_cpu_state);
+  rewindBegin();
+  powerFailBegin();
+  lowPowerBegin();  // Real time starts now
+  buzzerBegin(BUZZER_PIN);
 
   Serial.println(F("Ready!\n"));
   setLedOff();
+  g_boot.services = bootLap();
 }
 
 // ==================== LOOP ====================
 
 void loop() {
   static uint32_t last_debug = 0;
+  uint32_t loopStart = micros();
 
-  // Update input state
-  updateInput();
-  encoderPcntPoll(true, &g_encStepAccum, &g_encMux);
+  // Captured button and encoder events to TamaLib
+  runGestureAction(gesturesPoll());
+  hw_apply_inputs(cpu_get_ticks());  // The batch below sees the changes due by now
 
   // Run Tamagotchi
-  tamalib_mainloop_step_by_step();
+  runBatch();
+  if (tamalib_get_exec_mode() == EXEC_MODE_PAUSE) recoverCore();
+  powerFailPoll(&g_cpu_state);
+  rtcStatePoll(&g_cpu_state);
 
   // Debug output every 5 seconds
   if (millis() - last_debug >= 5000) {
     last_debug = millis();
-    Serial.printf("Loop running, timestamp=%lu\n", millis());
+    KB_LOGD("Loop running, timestamp=%lu", millis());
+    encoderPcntLogStats();
   }
 
-  // Auto-save
-  if (millis() - g_lastSave > AUTO_SAVE_INTERVAL_MS) {
-    g_lastSave = millis();
-    Serial.println(F("Auto-save"));
-    cpu_get_state(&g_cpu_state);  // Get current CPU state
-    saveStateToEEPROM(&g_cpu_state);
-  }
+  // Event-driven auto-save (snapshot only, the flash write happens on the persist task)
+  saveTriggerPoll();
 
-  // Long press reset (5 sec)
-  static uint32_t resetStart = 0;
-  if (digitalRead(ENC_SW_PIN) == LOW) {
-    if (resetStart == 0) resetStart = millis();
-    else if (millis() - resetStart > 5000) {
-      Serial.println(F("RESET"));
-      eraseStateFromEEPROM();
-      ESP.restart();
-    }
-  } else {
-    resetStart = 0;
+  // Rewind history (one snapshot per emulated second)
+  rewindPoll(&g_cpu_state);
+
+#ifdef ENABLE_BUZZER_TRACE
+  dumpBuzzerTrace();
+#endif
+
+  // Iteration time before the pacing sleep, as stalled by saves
+  saveStateRecordLoop(micros() - loopStart);
+
+  // Real-time pacing; sleeps while idle
+  if (lowPowerPoll()) {
+    display.hibernate();
+    lowPowerDeepSleep(&g_cpu_state);
   }
 }
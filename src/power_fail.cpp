@@ -0,0 +1,265 @@
+// power_fail.cpp
+// KidsBar: power-fail emergency save into a reserved flash sector (see power_fail.h).
+#include "power_fail.h"
+
+#include <atomic>
+#include <esp_partition.h>
+#include <esp_rom_crc.h>
+#include <esp_system.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+#include "config.h"
+#include "save_journal.h"
+#include "save_trigger.h"
+#include "log_ring.h"
+
+static const uint32_t PF_MAGIC = 0x504D4154;  // "TAMP"
+static const uint16_t PF_PAGE_SIZE = 32;
+static const uint8_t  PF_PAGE_COUNT = MEMORY_SIZE / PF_PAGE_SIZE;
+static const uint32_t PF_SECTOR_SIZE = 4096;
+static const uint32_t PF_RECORD_STRIDE = 512;
+static const uint8_t  PF_RECORDS = PF_SECTOR_SIZE / PF_RECORD_STRIDE;
+
+// How long the task waits for the loop to reach an instruction boundary
+static const uint32_t POWER_FAIL_SYNC_US = 2000;
+static const TickType_t POWER_FAIL_SYNC_TICKS = pdMS_TO_TICKS((POWER_FAIL_SYNC_US + 999) / 1000);
+
+struct PowerFailHeader {
+  uint32_t magic;
+  uint32_t baseSeq;    // Journal record of `slot` the pages apply to (0 = every page present)
+  uint8_t  slot;
+  uint8_t  pageCount;
+  uint16_t dirtyMask;  // Bit n = RAM page n follows
+  uint16_t len;        // Body bytes: cpu_state_t + pages
+  uint16_t reserved;
+  uint32_t crc;        // CRC32 of header (crc = 0) + body
+};
+static_assert(MEMORY_SIZE % PF_PAGE_SIZE == 0 && PF_PAGE_COUNT <= 16, "RAM pages must fit the dirty mask");
+static_assert(sizeof(PowerFailHeader) + sizeof(cpu_state_t) + MEMORY_SIZE <= PF_RECORD_STRIDE, "record too large");
+
+enum CaptureState : uint8_t { PF_IDLE, PF_REQUESTED, PF_LOOP_CAPTURING, PF_CAPTURED, PF_TASK_CAPTURING };
+
+static const esp_partition_t* s_part = nullptr;
+static uint32_t s_sectorAddr = 0;
+static uint8_t s_nextRecord = PF_RECORDS;  // PF_RECORDS = nowhere left to write
+
+// Everything the emergency path touches is preallocated here
+static uint8_t s_record[PF_RECORD_STRIDE];
+static SaveImage s_capture;
+static SaveImage s_baseline;        // Last image the loop saved to the journal
+static uint32_t s_baselineSeq = 0;
+static uint8_t s_baselineSlot = 0;
+static cpu_state_t* s_state = nullptr;
+
+static std::atomic<uint8_t> s_capture_state(PF_IDLE);
+static std::atomic<bool> s_recordWritten(false);  // For the loop's follow-up journal save
+static TaskHandle_t s_taskHandle = nullptr;
+
+static uint32_t recordCrc(PowerFailHeader* h, const uint8_t* body) {
+  uint32_t saved = h->crc;
+  h->crc = 0;
+  uint32_t crc = esp_rom_crc32_le(0, (const uint8_t*)h, sizeof(*h));
+  h->crc = saved;
+  return esp_rom_crc32_le(crc, body, h->len);
+}
+
+// Serialize registers + dirty pages into s_record
+static void buildRecord() {
+  saveStateCapture(s_state, &s_capture);
+
+  PowerFailHeader* h = (PowerFailHeader*)s_record;
+  uint8_t* body = s_record + sizeof(PowerFailHeader);
+  uint8_t* p = body + sizeof(cpu_state_t);
+  memcpy(body, &s_capture.cpu, sizeof(cpu_state_t));
+
+  uint8_t slot = saveStateSlot();
+  bool haveBase = s_baselineSeq != 0 && s_baselineSlot == slot;
+  uint16_t mask = 0;
+  uint8_t count = 0;
+  for (uint8_t i = 0; i < PF_PAGE_COUNT; i++) {
+    const u4_t* page = s_capture.memory + i * PF_PAGE_SIZE;
+    if (haveBase && memcmp(page, s_baseline.memory + i * PF_PAGE_SIZE, PF_PAGE_SIZE) == 0) continue;
+    memcpy(p, page, PF_PAGE_SIZE);
+    p += PF_PAGE_SIZE;
+    mask |= 1 << i;
+    count++;
+  }
+
+  h->magic = PF_MAGIC;
+  h->baseSeq = haveBase ? s_baselineSeq : 0;
+  h->slot = slot;
+  h->pageCount = count;
+  h->dirtyMask = mask;
+  h->len = p - body;
+  h->reserved = 0xFFFF;
+  h->crc = recordCrc(h, body);
+}
+
+static void IRAM_ATTR powerSenseIsr() {
+  BaseType_t woken = pdFALSE;
+  vTaskNotifyGiveFromISR(s_taskHandle, &woken);
+  if (woken) portYIELD_FROM_ISR();
+}
+
+static void powerFailTask(void* arg) {
+  (void)arg;
+  while (true) {
+    ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+    if (s_nextRecord >= PF_RECORDS || !s_state) continue;  // Sector used up until the next boot
+
+    uint32_t t0 = micros();
+    s_capture_state = PF_REQUESTED;
+
+    // Prefer a capture by the loop at an instruction boundary; it notifies once done.
+    // Sleeping here leaves the core to the loop (and the flash cache to the write).
+    TickType_t deadline = xTaskGetTickCount() + POWER_FAIL_SYNC_TICKS;
+    while (s_capture_state.load() == PF_REQUESTED) {
+      TickType_t now = xTaskGetTickCount();
+      if ((int32_t)(deadline - now) <= 0) break;
+      ulTaskNotifyTake(pdTRUE, deadline - now);
+    }
+    uint8_t expected = PF_REQUESTED;
+    if (s_capture_state.compare_exchange_strong(expected, PF_TASK_CAPTURING)) {
+      buildRecord();  // Loop is stuck (E-ink refresh): best effort
+    } else {
+      while (s_capture_state.load() != PF_CAPTURED) ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+    }
+
+    const PowerFailHeader* h = (const PowerFailHeader*)s_record;
+    esp_err_t err = esp_partition_write(s_part, s_sectorAddr + s_nextRecord * PF_RECORD_STRIDE,
+                                        s_record, sizeof(PowerFailHeader) + h->len);
+    s_nextRecord++;
+    s_recordWritten = true;
+    s_capture_state = PF_IDLE;
+
+    // Only reached if the supply holds up long enough to log
+    KB_LOGW("[Power] Supply lost, emergency record %s (%u pages, %lu us)",
+            err == ESP_OK ? "written" : "FAILED", h->pageCount, (unsigned long)(micros() - t0));
+  }
+}
+
+bool powerFailRecover() {
+  if (esp_reset_reason() == ESP_RST_BROWNOUT) {
+    KB_LOGW("[Power] Last reset was a brown-out");
+  }
+  if (!saveJournalReady()) return false;
+  s_part = saveJournalPartition();
+  s_sectorAddr = saveJournalReservedOffset();
+
+  // Records are written in order, the last valid one is the newest
+  int8_t newest = -1;
+  for (uint8_t i = 0; i < PF_RECORDS; i++) {
+    PowerFailHeader* h = (PowerFailHeader*)s_record;
+    uint32_t addr = s_sectorAddr + i * PF_RECORD_STRIDE;
+    if (esp_partition_read(s_part, addr, s_record, sizeof(PowerFailHeader)) != ESP_OK) break;
+    if (h->magic == 0xFFFFFFFF) break;
+    if (h->magic != PF_MAGIC || h->len > sizeof(s_record) - sizeof(PowerFailHeader)) continue;
+    if (esp_partition_read(s_part, addr + sizeof(PowerFailHeader), s_record + sizeof(PowerFailHeader), h->len) != ESP_OK) continue;
+    if (recordCrc(h, s_record + sizeof(PowerFailHeader)) == h->crc) newest = i;
+  }
+  if (newest < 0) return false;
+
+  // Re-read the newest one (the scan may have overwritten the buffer with a torn record)
+  uint32_t addr = s_sectorAddr + newest * PF_RECORD_STRIDE;
+  esp_partition_read(s_part, addr, s_record, sizeof(s_record));
+  const PowerFailHeader* h = (const PowerFailHeader*)s_record;
+  const uint8_t* body = s_record + sizeof(PowerFailHeader);
+
+  if (h->slot >= JOURNAL_MAX_SLOTS || h->pageCount > PF_PAGE_COUNT ||
+      h->len != sizeof(cpu_state_t) + h->pageCount * PF_PAGE_SIZE) {
+    return false;
+  }
+
+  // The pages only make sense on top of the save they were diffed against
+  if (h->baseSeq != 0) {
+    uint16_t len = 0;
+    if (saveJournalLatestSeq(h->slot) != h->baseSeq ||
+        !saveJournalReadLatest(h->slot, &s_capture, sizeof(s_capture), &len) || len != sizeof(s_capture)) {
+      KB_LOGI("[Power] Emergency record is older than the journal, ignored");
+      return false;
+    }
+  } else if (h->pageCount != PF_PAGE_COUNT) {
+    return false;
+  }
+
+  memcpy(&s_capture.cpu, body, sizeof(cpu_state_t));
+  s_capture.cpu.memory = NULL;
+  const uint8_t* p = body + sizeof(cpu_state_t);
+  for (uint8_t i = 0; i < PF_PAGE_COUNT; i++) {
+    if (!(h->dirtyMask & (1 << i))) continue;
+    memcpy(s_capture.memory + i * PF_PAGE_SIZE, p, PF_PAGE_SIZE);
+    p += PF_PAGE_SIZE;
+  }
+
+  bool ok = saveJournalAppend(h->slot, &s_capture, sizeof(s_capture));
+  KB_LOGI("[Power] Recovered emergency record for slot %u (%u pages): %s", h->slot, h->pageCount,
+          ok ? "saved" : "journal write failed");
+  return ok;
+}
+
+void powerFailBegin() {
+  if (!saveJournalReady()) return;
+  s_part = saveJournalPartition();
+  s_sectorAddr = saveJournalReservedOffset();
+
+  // Pre-erase now, so the emergency write is a single program
+  uint32_t blank = 0;
+  bool used = false;
+  for (uint8_t i = 0; i < PF_RECORDS && !used; i++) {
+    esp_partition_read(s_part, s_sectorAddr + i * PF_RECORD_STRIDE, &blank, sizeof(blank));
+    used = blank != 0xFFFFFFFF;
+  }
+  if (used && esp_partition_erase_range(s_part, s_sectorAddr, PF_SECTOR_SIZE) != ESP_OK) {
+    KB_LOGE("[Power] Could not erase the emergency sector");
+    return;
+  }
+  s_nextRecord = 0;
+
+  if (POWER_SENSE_PIN < 0) {
+    KB_LOGI("[Power] No supply-sense pin, emergency save disabled");
+    return;
+  }
+
+  xTaskCreatePinnedToCore(powerFailTask, "powerFail", 4096, nullptr, configMAX_PRIORITIES - 1, &s_taskHandle, 0);
+  pinMode(POWER_SENSE_PIN, INPUT);
+  attachInterrupt(digitalPinToInterrupt(POWER_SENSE_PIN), powerSenseIsr,
+                  POWER_SENSE_FAIL_LEVEL == LOW ? FALLING : RISING);
+}
+
+void powerFailPoll(cpu_state_t* state) {
+  if (POWER_SENSE_PIN < 0) return;
+  s_state = state;
+
+  uint8_t expected = PF_REQUESTED;
+  if (s_capture_state.load() == PF_REQUESTED &&
+      s_capture_state.compare_exchange_strong(expected, PF_LOOP_CAPTURING)) {
+    buildRecord();
+    s_capture_state = PF_CAPTURED;
+    if (s_taskHandle) xTaskNotifyGive(s_taskHandle);
+    return;
+  }
+
+  // Still running after the emergency record (the supply dipped and held, or is
+  // fading slowly): follow up with a full journal save. It supersedes the record,
+  // and the sector only holds PF_RECORDS of them until the next boot.
+  if (s_recordWritten.exchange(false)) {
+    saveTriggerNow(SAVE_REASON_BROWNOUT);
+  }
+
+  // Adopt the image the last save wrote, straight from RAM (flash is never read back)
+  uint8_t slot = 0;
+  uint32_t seq = 0;
+  const SaveImage* saved = saveStatePersisted(&slot, &seq);
+  if (s_capture_state.load() != PF_IDLE || !saved || (seq == s_baselineSeq && slot == s_baselineSlot)) return;
+
+  s_baselineSeq = 0;  // Invalid while being replaced
+  memcpy(&s_baseline, saved, sizeof(s_baseline));
+  s_baselineSlot = slot;
+  s_baselineSeq = seq;
+}
+
+bool powerFailPending() {
+  return s_capture_state.load() != PF_IDLE;
+}
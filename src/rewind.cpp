@@ -0,0 +1,203 @@
+// rewind.cpp
+// KidsBar: keyframe + XOR/RLE delta ring of recent emulator states (see rewind.h).
+#include "rewind.h"
+
+#include <esp_heap_caps.h>
+
+#include "log_ring.h"
+
+extern "C" {
+#include "hw.h"
+}
+
+struct RewindEntry {
+  uint32_t offset;  // Arena offset of the encoded snapshot
+  uint32_t tick;    // Emulated tick it was taken at
+  uint16_t len;     // Encoded length (0 = delta with no change)
+  bool key;         // Whole SaveImage rather than a delta
+};
+
+static const uint16_t IMAGE_SIZE = sizeof(SaveImage);
+
+static uint8_t* s_arena = nullptr;
+static uint32_t s_arenaSize = 0;
+static uint32_t s_writePos = 0;
+
+static RewindEntry s_entries[REWIND_MAX_ENTRIES];
+static uint16_t s_first = 0;  // Oldest entry (ring index)
+static uint16_t s_count = 0;
+
+static SaveImage s_prev;      // Newest snapshot, deltas are taken against it
+static SaveImage s_work;      // Decode buffer
+static uint8_t s_sinceKey = 0;
+static uint32_t s_lastTick = 0;
+static bool s_started = false;
+
+// Worst case delta is [skip][run] per 255 bytes plus every byte; above IMAGE_SIZE a keyframe wins
+static uint8_t s_encoded[IMAGE_SIZE];
+
+static inline RewindEntry& entryAt(uint16_t i) {
+  return s_entries[(s_first + i) % REWIND_MAX_ENTRIES];
+}
+
+// XOR run-length delta: repeated [skip][run][run bytes of cur ^ prev].
+// Returns 0 if it would not be smaller than a keyframe.
+static uint16_t encodeDelta(const uint8_t* cur, const uint8_t* prev, uint8_t* out) {
+  uint16_t n = 0, i = 0;
+  while (i < IMAGE_SIZE) {
+    uint8_t skip = 0;
+    while (i < IMAGE_SIZE && cur[i] == prev[i] && skip < 255) { i++; skip++; }
+    uint8_t run = 0;
+    while (i + run < IMAGE_SIZE && cur[i + run] != prev[i + run] && run < 255) run++;
+    if (run == 0 && i >= IMAGE_SIZE) break;  // Trailing unchanged bytes
+
+    if (n + 2 + run >= IMAGE_SIZE) return 0;
+    out[n++] = skip;
+    out[n++] = run;
+    for (uint8_t k = 0; k < run; k++) out[n++] = cur[i + k] ^ prev[i + k];
+    i += run;
+  }
+  return n;
+}
+
+static void applyDelta(uint8_t* img, const uint8_t* in, uint16_t len) {
+  uint16_t i = 0, p = 0;
+  while (p + 2 <= len) {
+    i += in[p++];
+    uint8_t run = in[p++];
+    for (uint8_t k = 0; k < run && i < IMAGE_SIZE; k++) img[i++] ^= in[p++];
+  }
+}
+
+// Drop the oldest keyframe and the deltas that depend on it
+static void dropOldestGroup() {
+  do {
+    s_first = (s_first + 1) % REWIND_MAX_ENTRIES;
+    s_count--;
+  } while (s_count && !entryAt(0).key);
+}
+
+// Make room for len bytes after the newest entry, wrapping to the arena start if needed
+static uint32_t reserve(uint16_t len) {
+  uint32_t pos = s_writePos;
+  if (pos + len > s_arenaSize) pos = 0;
+
+  while (s_count) {
+    const RewindEntry& old = entryAt(0);
+    bool overlaps = old.offset < pos + len && pos < old.offset + old.len;
+    if (!overlaps) break;
+    dropOldestGroup();
+  }
+  return pos;
+}
+
+bool rewindBegin() {
+  if (s_arena) return true;
+
+  s_arenaSize = REWIND_ARENA_BYTES;
+  s_arena = (uint8_t*)heap_caps_malloc(s_arenaSize, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+  if (!s_arena) {
+    s_arenaSize = REWIND_ARENA_BYTES_INTERNAL;
+    s_arena = (uint8_t*)heap_caps_malloc(s_arenaSize, MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+  }
+  if (!s_arena) {
+    s_arenaSize = 0;
+    KB_LOGW("[Rewind] No memory, rewind disabled");
+    return false;
+  }
+
+  KB_LOGI("[Rewind] %lu KB arena, %u snapshots max", (unsigned long)(s_arenaSize / 1024), REWIND_MAX_ENTRIES);
+  rewindReset();
+  return true;
+}
+
+void rewindReset() {
+  s_first = 0;
+  s_count = 0;
+  s_writePos = 0;
+  s_sinceKey = 0;
+  s_started = false;
+}
+
+void rewindPoll(cpu_state_t* state) {
+  if (!s_arena) return;
+
+  u32_t now = cpu_get_ticks();
+  if (s_started && now - s_lastTick < REWIND_PERIOD_TICKS) return;
+
+  saveStateCapture(state, &s_work);
+
+  uint16_t len = 0;
+  bool key = !s_started || s_sinceKey >= REWIND_KEYFRAME_INTERVAL - 1;
+  if (!key) {
+    len = encodeDelta((const uint8_t*)&s_work, (const uint8_t*)&s_prev, s_encoded);
+    key = (len == 0 && memcmp(&s_work, &s_prev, IMAGE_SIZE) != 0);  // Delta too large
+  }
+  const uint8_t* data = s_encoded;
+  if (key) {
+    len = IMAGE_SIZE;
+    data = (const uint8_t*)&s_work;
+  }
+
+  if (s_count == REWIND_MAX_ENTRIES) dropOldestGroup();
+  uint32_t pos = reserve(len);
+  memcpy(s_arena + pos, data, len);
+
+  RewindEntry& e = s_entries[(s_first + s_count) % REWIND_MAX_ENTRIES];
+  e.offset = pos;
+  e.tick = now;
+  e.len = len;
+  e.key = key;
+  s_count++;
+
+  s_writePos = pos + len;
+  s_sinceKey = key ? 0 : s_sinceKey + 1;
+  s_prev = s_work;
+  // Keep a steady cadence unless the loop fell a whole period behind
+  if (!s_started || now - s_lastTick >= 2 * REWIND_PERIOD_TICKS) {
+    s_lastTick = now;
+  } else {
+    s_lastTick += REWIND_PERIOD_TICKS;
+  }
+  s_started = true;
+}
+
+uint16_t rewindDepth() {
+  return s_count;
+}
+
+bool rewindRestore(cpu_state_t* state, uint16_t back) {
+  if (back >= s_count) return false;
+
+  uint16_t target = s_count - 1 - back;
+  uint16_t key = target;
+  while (!entryAt(key).key) key--;  // The oldest entry is always a keyframe
+
+  memcpy(&s_work, s_arena + entryAt(key).offset, IMAGE_SIZE);
+  for (uint16_t i = key + 1; i <= target; i++) {
+    applyDelta((uint8_t*)&s_work, s_arena + entryAt(i).offset, entryAt(i).len);
+  }
+  saveStateApply(state, &s_work);
+  hw_clear_inputs();  // Presses queued for the abandoned timeline
+
+  // Continue recording from the restored point
+  const RewindEntry& t = entryAt(target);
+  s_count = target + 1;
+  s_writePos = t.offset + t.len;
+  s_sinceKey = target - key;
+  s_prev = s_work;
+  s_lastTick = t.tick;
+
+  KB_LOGI("[Rewind] Restored %u s back (decoded %u snapshots)", back, target - key + 1);
+  return true;
+}
+
+uint32_t rewindMemoryUsed() {
+  if (!s_count) return 0;
+  uint32_t start = entryAt(0).offset;
+  return (s_writePos >= start) ? s_writePos - start : s_arenaSize - start + s_writePos;
+}
+
+uint32_t rewindMemorySize() {
+  return s_arenaSize;
+}
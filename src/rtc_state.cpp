@@ -0,0 +1,99 @@
+// rtc_state.cpp
+// KidsBar: double-buffered RTC memory mirror of the emulator state (see rtc_state.h).
+#include "rtc_state.h"
+
+#include <esp_rom_crc.h>
+#include <esp_system.h>
+#include <esp_timer.h>
+
+#include "log_ring.h"
+
+static const uint32_t HOT_MAGIC = 0x484D4154;  // "TAMH"
+
+struct HotState {
+  uint32_t magic;  // Written last
+  uint32_t crc;    // CRC32 of seq + slot + image
+  uint32_t seq;
+  uint8_t slot;    // Save slot the game belongs to
+  SaveImage image;
+};
+RTC_NOINIT_ATTR static HotState s_hot[2];
+
+static uint32_t s_seq = 0;
+static u32_t s_lastTick = 0;
+static bool s_stored = false;
+static int s_restoredSlot = -1;
+
+static uint32_t hotCrc(const HotState& h) {
+  const uint8_t* body = (const uint8_t*)&h.seq;
+  return esp_rom_crc32_le(0, body, sizeof(HotState) - offsetof(HotState, seq));
+}
+
+// The CRC catches a reset mid-copy, the check a firmware with another layout
+static bool intact(const HotState& h) {
+  return h.magic == HOT_MAGIC && h.crc == hotCrc(h) && saveStateValid(&h.image);
+}
+
+// Index of the newest intact copy, -1 if none
+static int newest() {
+  // Only resume after a deep sleep or a deliberate restart. RTC memory does not
+  // survive a power-on, and a state that panics or trips a watchdog would
+  // otherwise come back after every crash.
+  esp_reset_reason_t reason = esp_reset_reason();
+  if (reason != ESP_RST_DEEPSLEEP && reason != ESP_RST_SW) return -1;
+
+  int best = -1;
+  for (int i = 0; i < 2; i++) {
+    if (!intact(s_hot[i])) continue;
+    if (best < 0 || (int32_t)(s_hot[i].seq - s_hot[best].seq) > 0) best = i;
+  }
+  return best;
+}
+
+void rtcStateStore(cpu_state_t* state) {
+  // Overwrite the older copy; it stays invalid until the magic goes in
+  HotState& h = s_hot[s_seq & 1];
+  h.magic = 0;
+  h.seq = s_seq++;
+  h.slot = saveStateSlot();
+  saveStateCapture(state, &h.image);
+  h.crc = hotCrc(h);
+  h.magic = HOT_MAGIC;
+
+  s_lastTick = cpu_get_ticks();
+  s_stored = true;
+}
+
+void rtcStatePoll(cpu_state_t* state) {
+  if (s_stored && cpu_get_ticks() - s_lastTick < RTC_MIRROR_PERIOD_TICKS) return;
+  rtcStateStore(state);
+}
+
+bool rtcStateValid() {
+  return newest() >= 0;
+}
+
+bool rtcStateRestore(cpu_state_t* state) {
+  int i = newest();
+  if (i < 0) return false;
+
+  saveStateApply(state, &s_hot[i].image);
+  s_seq = s_hot[i].seq + 1;  // Keep the restored copy until a newer one is complete
+  s_lastTick = cpu_get_ticks();
+  s_stored = true;
+  s_restoredSlot = s_hot[i].slot;
+
+  KB_LOGI("[RTC] Hot state #%lu (slot %u) restored %lu us after reset", (unsigned long)s_hot[i].seq,
+          s_hot[i].slot, (unsigned long)esp_timer_get_time());
+  return true;
+}
+
+int rtcStateRestoredSlot() {
+  return s_restoredSlot;
+}
+
+void rtcStateClear() {
+  s_hot[0].magic = 0;
+  s_hot[1].magic = 0;
+  s_stored = false;
+}
@@ -0,0 +1,360 @@
+// save_journal.cpp
+// KidsBar: append-only save-state journal (see save_journal.h for the layout).
+#include "save_journal.h"
+
+#include <esp_partition.h>
+#include <esp_rom_crc.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+
+#include "log_ring.h"
+
+static const uint32_t JOURNAL_MAGIC = 0x4A4D4154;  // "TAMJ"
+static const uint32_t JOURNAL_RECORD_SIZE = 512;
+static const uint32_t JOURNAL_SECTOR_SIZE = 4096;
+static const uint32_t JOURNAL_RECORDS_PER_SECTOR = JOURNAL_SECTOR_SIZE / JOURNAL_RECORD_SIZE;
+
+struct JournalHeader {
+  uint32_t magic;
+  uint32_t seq;    // Strictly increasing, never 0 or 0xFFFFFFFF
+  uint16_t len;    // Payload bytes, 0 = tombstone
+  uint8_t  slot;
+  uint8_t  version;
+  uint32_t crc;    // CRC32 of the header (crc = 0) + payload
+};
+static_assert(sizeof(JournalHeader) == 16, "journal header must stay 16 bytes");
+static_assert(sizeof(JournalHeader) + JOURNAL_MAX_PAYLOAD == JOURNAL_RECORD_SIZE, "record size");
+static_assert(JOURNAL_MAX_SLOTS <= JOURNAL_RECORDS_PER_SECTOR, "live records of a sector must fit the stash");
+
+static const uint8_t JOURNAL_VERSION = 1;
+
+struct SlotEntry {
+  uint32_t seq;     // 0 = no record
+  uint32_t index;   // Record index
+  uint16_t len;     // 0 = tombstone
+};
+
+static const esp_partition_t* s_part = nullptr;
+static uint32_t s_recordCount = 0;
+static uint32_t s_sectorCount = 0;
+static uint32_t s_head = 0;        // Next record index to write
+static uint32_t s_nextSeq = 1;
+static uint32_t s_erasedSector = UINT32_MAX;  // Sector known erased, not entered by the head yet
+static uint32_t s_erasingSector = UINT32_MAX; // Sector the journal task erases without the mutex
+static SlotEntry s_slots[JOURNAL_MAX_SLOTS];
+
+static SemaphoreHandle_t s_mutex = nullptr;
+static TaskHandle_t s_taskHandle = nullptr;
+
+// Scratch buffers, only used with s_mutex held. Static so a save never depends on the heap.
+static uint8_t s_record[JOURNAL_RECORD_SIZE];
+static uint8_t s_pending[JOURNAL_RECORD_SIZE];                            // Payload parked by writeRecord()
+static uint8_t s_stash[JOURNAL_RECORDS_PER_SECTOR * JOURNAL_RECORD_SIZE];  // Live records across an erase
+
+static inline uint32_t recordAddr(uint32_t index) { return index * JOURNAL_RECORD_SIZE; }
+static inline uint32_t sectorOf(uint32_t index) { return index / JOURNAL_RECORDS_PER_SECTOR; }
+
+static uint32_t recordCrc(const JournalHeader* h, const uint8_t* payload) {
+  JournalHeader tmp = *h;
+  tmp.crc = 0;
+  uint32_t crc = esp_rom_crc32_le(0, (const uint8_t*)&tmp, sizeof(tmp));
+  return esp_rom_crc32_le(crc, payload, h->len);
+}
+
+static bool readHeader(uint32_t index, JournalHeader* h) {
+  return esp_partition_read(s_part, recordAddr(index), h, sizeof(*h)) == ESP_OK;
+}
+
+static bool isBlank(const JournalHeader* h) {
+  const uint8_t* p = (const uint8_t*)h;
+  for (size_t i = 0; i < sizeof(*h); i++) {
+    if (p[i] != 0xFF) return false;
+  }
+  return true;
+}
+
+// Read a full record into s_record and check it. Mutex held.
+static bool readRecord(uint32_t index) {
+  if (esp_partition_read(s_part, recordAddr(index), s_record, JOURNAL_RECORD_SIZE) != ESP_OK) return false;
+  const JournalHeader* h = (const JournalHeader*)s_record;
+  if (h->magic != JOURNAL_MAGIC || h->len > JOURNAL_MAX_PAYLOAD || h->slot >= JOURNAL_MAX_SLOTS) return false;
+  return recordCrc(h, s_record + sizeof(JournalHeader)) == h->crc;
+}
+
+static bool prepareHeadSector();
+
+// Write s_record (payload already in place) at the head. Mutex held.
+static bool writeRecord(uint8_t slot, uint16_t len) {
+  uint32_t index = s_head;
+
+  // Compaction normally got there first. Preparing reuses s_record, so the
+  // pending payload is parked meanwhile. The rewritten live records can fill the
+  // whole sector (JOURNAL_MAX_SLOTS == JOURNAL_RECORDS_PER_SECTOR): the head then
+  // reaches the next sector, which needs preparing too.
+  if (index % JOURNAL_RECORDS_PER_SECTOR == 0 && sectorOf(index) != s_erasedSector) {
+    memcpy(s_pending, s_record, JOURNAL_RECORD_SIZE);
+    bool ok = true;
+    while (ok && s_head % JOURNAL_RECORDS_PER_SECTOR == 0 && sectorOf(s_head) != s_erasedSector) {
+      ok = prepareHeadSector();
+    }
+    memcpy(s_record, s_pending, JOURNAL_RECORD_SIZE);
+    if (!ok) return false;
+    index = s_head;
+  }
+
+  JournalHeader* h = (JournalHeader*)s_record;
+  h->magic = JOURNAL_MAGIC;
+  h->seq = s_nextSeq;
+  h->len = len;
+  h->slot = slot;
+  h->version = JOURNAL_VERSION;
+  h->crc = recordCrc(h, s_record + sizeof(JournalHeader));
+
+  // Unused tail stays 0xFF so the record is a single program of erased flash
+  memset(s_record + sizeof(JournalHeader) + len, 0xFF, JOURNAL_MAX_PAYLOAD - len);
+  if (esp_partition_write(s_part, recordAddr(index), s_record, JOURNAL_RECORD_SIZE) != ESP_OK) {
+    return false;
+  }
+
+  if (sectorOf(index) == s_erasedSector) {
+    s_erasedSector = UINT32_MAX;
+  }
+
+  s_slots[slot].seq = s_nextSeq;
+  s_slots[slot].index = index;
+  s_slots[slot].len = len;
+
+  s_nextSeq++;
+  s_head = (index + 1) % s_recordCount;
+  return true;
+}
+
+// Fallback when the head reaches a sector that compaction did not prepare:
+// live records it holds are kept in RAM across the erase and rewritten first.
+static bool prepareHeadSector() {
+  uint32_t sector = sectorOf(s_head);
+  uint8_t live[JOURNAL_MAX_SLOTS];
+  uint8_t count = 0;
+
+  for (uint8_t slot = 0; slot < JOURNAL_MAX_SLOTS; slot++) {
+    if (s_slots[slot].seq != 0 && sectorOf(s_slots[slot].index) == sector) live[count++] = slot;
+  }
+
+  for (uint8_t i = 0; i < count; i++) {
+    if (readRecord(s_slots[live[i]].index)) {
+      memcpy(s_stash + i * JOURNAL_RECORD_SIZE, s_record, JOURNAL_RECORD_SIZE);
+    } else {
+      s_slots[live[i]].seq = 0;
+    }
+  }
+
+  bool ok = esp_partition_erase_range(s_part, sector * JOURNAL_SECTOR_SIZE, JOURNAL_SECTOR_SIZE) == ESP_OK;
+  if (ok) s_erasedSector = sector;
+
+  for (uint8_t i = 0; ok && i < count; i++) {
+    if (s_slots[live[i]].seq == 0) continue;
+    memcpy(s_record, s_stash + i * JOURNAL_RECORD_SIZE, JOURNAL_RECORD_SIZE);
+    ok = writeRecord(live[i], ((JournalHeader*)s_record)->len);
+  }
+
+  if (!ok) KB_LOGE("[Journal] Could not prepare sector %u", sector);
+  return ok;
+}
+
+bool saveJournalBegin() {
+  if (s_part) return true;
+
+  s_part = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_DATA_SPIFFS, nullptr);
+  if (!s_part) {
+    KB_LOGW("[Journal] No spiffs partition, journal disabled");
+    return false;
+  }
+  if (!s_mutex) s_mutex = xSemaphoreCreateMutex();
+
+  s_sectorCount = s_part->size / JOURNAL_SECTOR_SIZE - JOURNAL_RESERVED_SECTORS;
+  s_recordCount = s_sectorCount * JOURNAL_RECORDS_PER_SECTOR;
+  memset(s_slots, 0, sizeof(s_slots));
+
+  uint32_t t0 = millis();
+
+  // 1) The newest sector is the one whose first record has the highest sequence
+  // (a torn header could carry any sequence, so candidates are CRC-checked)
+  uint32_t bestSeq = 0, bestSector = 0;
+  JournalHeader h;
+  xSemaphoreTake(s_mutex, portMAX_DELAY);
+  for (uint32_t s = 0; s < s_sectorCount; s++) {
+    if (!readHeader(s * JOURNAL_RECORDS_PER_SECTOR, &h)) continue;
+    if (h.magic == JOURNAL_MAGIC && h.seq > bestSeq && readRecord(s * JOURNAL_RECORDS_PER_SECTOR)) {
+      bestSeq = h.seq;
+      bestSector = s;
+    }
+  }
+  xSemaphoreGive(s_mutex);
+
+  if (bestSeq == 0) {
+    // Blank journal
+    s_head = 0;
+    s_nextSeq = 1;
+    KB_LOGI("[Journal] Empty, %u records available", s_recordCount);
+    return true;
+  }
+
+  // 2) Head = first blank record after the newest sector start
+  const uint32_t first = bestSector * JOURNAL_RECORDS_PER_SECTOR;
+  uint32_t newest = first;
+  uint32_t maxSeq = bestSeq;
+  for (uint32_t i = 1; i < JOURNAL_RECORDS_PER_SECTOR; i++) {
+    uint32_t index = first + i;
+    if (!readHeader(index, &h) || isBlank(&h)) break;
+    if (h.magic == JOURNAL_MAGIC && h.seq > maxSeq) maxSeq = h.seq;
+    newest = index;
+  }
+  s_head = (newest + 1) % s_recordCount;
+  s_nextSeq = maxSeq + 1;
+
+  // Entering a new sector: it was pre-erased by compaction if its first record is blank
+  if (s_head % JOURNAL_RECORDS_PER_SECTOR == 0 && readHeader(s_head, &h) && isBlank(&h)) {
+    s_erasedSector = sectorOf(s_head);
+  }
+
+  // 3) Walk backwards to find the newest valid record of each slot
+  uint8_t resolved = 0;
+  xSemaphoreTake(s_mutex, portMAX_DELAY);
+  for (uint32_t n = 0; n < s_recordCount && resolved < JOURNAL_MAX_SLOTS; n++) {
+    uint32_t index = (newest + s_recordCount - n) % s_recordCount;
+    if (!readHeader(index, &h) || h.magic != JOURNAL_MAGIC) continue;
+    if (h.slot >= JOURNAL_MAX_SLOTS || s_slots[h.slot].seq != 0) continue;
+    if (h.seq > maxSeq) continue;  // Stale record from a previous lap numbering
+    if (!readRecord(index)) {
+      KB_LOGW("[Journal] Skipping corrupt record #%u (slot %u)", h.seq, h.slot);
+      continue;
+    }
+    s_slots[h.slot].seq = h.seq;
+    s_slots[h.slot].index = index;
+    s_slots[h.slot].len = h.len;
+    resolved++;
+  }
+  xSemaphoreGive(s_mutex);
+
+  KB_LOGI("[Journal] Head at record %u, seq %u, recovered in %lu ms",
+          s_head, s_nextSeq, (unsigned long)(millis() - t0));
+  return true;
+}
+
+bool saveJournalReady() {
+  return s_part != nullptr;
+}
+
+const esp_partition_t* saveJournalPartition() {
+  return s_part;
+}
+
+uint32_t saveJournalReservedOffset() {
+  return s_sectorCount * JOURNAL_SECTOR_SIZE;
+}
+
+bool saveJournalAppend(uint8_t slot, const void* data, uint16_t len) {
+  if (!s_part || slot >= JOURNAL_MAX_SLOTS || len > JOURNAL_MAX_PAYLOAD) return false;
+
+  xSemaphoreTake(s_mutex, portMAX_DELAY);
+  // The head caught up with the sector being erased (a full sector within one erase)
+  while (s_head % JOURNAL_RECORDS_PER_SECTOR == 0 && sectorOf(s_head) == s_erasingSector) {
+    xSemaphoreGive(s_mutex);
+    vTaskDelay(1);
+    xSemaphoreTake(s_mutex, portMAX_DELAY);
+  }
+  if (len) memcpy(s_record + sizeof(JournalHeader), data, len);
+  bool ok = writeRecord(slot, len);
+  xSemaphoreGive(s_mutex);
+
+  if (!ok) {
+    KB_LOGE("[Journal] Append failed at record %u", s_head);
+  }
+
+  // Let compaction prepare the next sector while we are not writing
+  if (s_taskHandle) xTaskNotifyGive(s_taskHandle);
+  return ok;
+}
+
+bool saveJournalReadLatest(uint8_t slot, void* data, uint16_t maxLen, uint16_t* lenOut) {
+  if (!s_part || slot >= JOURNAL_MAX_SLOTS) return false;
+
+  xSemaphoreTake(s_mutex, portMAX_DELAY);
+  const SlotEntry e = s_slots[slot];
+  bool ok = e.seq != 0 && e.len != 0 && e.len <= maxLen && readRecord(e.index);
+  if (ok) {
+    memcpy(data, s_record + sizeof(JournalHeader), e.len);
+    if (lenOut) *lenOut = e.len;
+  }
+  xSemaphoreGive(s_mutex);
+  return ok;
+}
+
+bool saveJournalHasRecord(uint8_t slot) {
+  return slot < JOURNAL_MAX_SLOTS && s_slots[slot].seq != 0 && s_slots[slot].len != 0;
+}
+
+uint32_t saveJournalLatestSeq(uint8_t slot) {
+  return (slot < JOURNAL_MAX_SLOTS) ? s_slots[slot].seq : 0;
+}
+
+void saveJournalService() {
+  if (!s_part) return;
+
+  xSemaphoreTake(s_mutex, portMAX_DELAY);
+  for (;;) {
+    if (s_head % JOURNAL_RECORDS_PER_SECTOR == 0) {
+      // About to enter a new sector, the one after it is handled after the next append.
+      // Compaction fell behind: this fallback erases with the mutex held.
+      if (sectorOf(s_head) != s_erasedSector) prepareHeadSector();
+      break;
+    }
+
+    uint32_t target = (sectorOf(s_head) + 1) % s_sectorCount;
+    if (target == s_erasedSector) break;
+
+    // Copy live records out of the next sector first (they land in the head sector)
+    for (uint8_t slot = 0; slot < JOURNAL_MAX_SLOTS && sectorOf(s_head) != target; slot++) {
+      const SlotEntry e = s_slots[slot];
+      if (e.seq == 0 || sectorOf(e.index) != target) continue;
+      if (readRecord(e.index)) {
+        writeRecord(slot, e.len);
+      } else {
+        s_slots[slot].seq = 0;
+      }
+    }
+    // The head sector filled up meanwhile, start over from the new head
+    if (s_head % JOURNAL_RECORDS_PER_SECTOR == 0) continue;
+
+    // Nothing live is left in the target: erase it without the mutex, so reads and
+    // appends to the head sector go on meanwhile
+    s_erasingSector = target;
+    xSemaphoreGive(s_mutex);
+    bool ok = esp_partition_erase_range(s_part, target * JOURNAL_SECTOR_SIZE, JOURNAL_SECTOR_SIZE) == ESP_OK;
+    xSemaphoreTake(s_mutex, portMAX_DELAY);
+    s_erasingSector = UINT32_MAX;
+
+    if (!ok) {
+      KB_LOGE("[Journal] Erase of sector %u failed", target);
+      break;
+    }
+    s_erasedSector = target;
+  }
+  xSemaphoreGive(s_mutex);
+}
+
+static void journalTask(void* arg) {
+  (void)arg;
+  while (true) {
+    saveJournalService();
+    ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+  }
+}
+
+void saveJournalStartTask(uint8_t priority, uint8_t core) {
+  if (s_taskHandle || !s_part) return;
+  if (core > 1) core = 0;
+  xTaskCreatePinnedToCore(journalTask, "saveJournal", 4096, nullptr, priority, &s_taskHandle, core);
+}
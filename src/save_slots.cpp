@@ -0,0 +1,160 @@
+// save_slots.cpp
+// KidsBar: named save slots (see save_slots.h).
+#include "save_slots.h"
+
+#include <ctype.h>
+
+#include "save_journal.h"
+#include "log_ring.h"
+
+// The index lives in the last journal slot
+static const uint8_t JOURNAL_SLOT_INDEX = JOURNAL_MAX_SLOTS - 1;
+static_assert(SAVE_SLOT_COUNT <= JOURNAL_SLOT_INDEX, "game slots overlap the slot index");
+static_assert(SAVE_SLOT_NAME_LEN * 6 <= 64, "packed name must fit 64 bits");
+
+static const uint8_t SLOT_INDEX_VERSION = 1;
+
+// On-flash index: 6-bit packed names (code 0 = end of name)
+struct SlotIndexRecord {
+  uint8_t version;
+  uint8_t active;
+  uint8_t count;
+  uint8_t reserved;
+  uint64_t names[SAVE_SLOT_COUNT];
+};
+
+const char SAVE_SLOT_NAME_CHARSET[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789 -.";
+
+static uint8_t s_active = 0;
+static char s_names[SAVE_SLOT_COUNT][SAVE_SLOT_NAME_LEN + 1];
+
+// RAM copies of slot saves, so restore does not wait on flash
+static SaveImage s_cache[SAVE_SLOT_COUNT];
+static bool s_cached[SAVE_SLOT_COUNT];
+static uint32_t s_cacheSeq[SAVE_SLOT_COUNT];  // Journal sequence the copy matches
+
+// A newer journal record (auto-save, erase) makes the RAM copy stale
+static bool cacheValid(uint8_t slot) {
+  return s_cached[slot] && s_cacheSeq[slot] == saveJournalLatestSeq(slot);
+}
+
+static uint64_t packName(const char* name) {
+  uint64_t packed = 0;
+  for (uint8_t i = 0; i < SAVE_SLOT_NAME_LEN && name[i]; i++) {
+    const char* pos = strchr(SAVE_SLOT_NAME_CHARSET, toupper((unsigned char)name[i]));
+    uint8_t code = pos ? (uint8_t)(pos - SAVE_SLOT_NAME_CHARSET + 1) : 37;  // Unknown -> space
+    packed |= (uint64_t)code << (i * 6);
+  }
+  return packed;
+}
+
+static void unpackName(uint64_t packed, char* out) {
+  uint8_t i = 0;
+  for (; i < SAVE_SLOT_NAME_LEN; i++) {
+    uint8_t code = (packed >> (i * 6)) & 0x3F;
+    if (code == 0 || code > sizeof(SAVE_SLOT_NAME_CHARSET) - 1) break;
+    out[i] = SAVE_SLOT_NAME_CHARSET[code - 1];
+  }
+  out[i] = '\0';
+}
+
+static void defaultName(uint8_t slot, char* out) {
+  snprintf(out, SAVE_SLOT_NAME_LEN + 1, "SLOT %u", slot + 1);
+}
+
+static bool writeIndex() {
+  SlotIndexRecord rec = {};
+  rec.version = SLOT_INDEX_VERSION;
+  rec.active = s_active;
+  rec.count = SAVE_SLOT_COUNT;
+  for (uint8_t i = 0; i < SAVE_SLOT_COUNT; i++) {
+    rec.names[i] = packName(s_names[i]);
+  }
+  return saveJournalAppend(JOURNAL_SLOT_INDEX, &rec, sizeof(rec));
+}
+
+void saveSlotsBegin() {
+  for (uint8_t i = 0; i < SAVE_SLOT_COUNT; i++) {
+    defaultName(i, s_names[i]);
+    s_cached[i] = false;
+  }
+  s_active = 0;
+
+  SlotIndexRecord rec;
+  uint16_t len = 0;
+  if (saveJournalReadLatest(JOURNAL_SLOT_INDEX, &rec, sizeof(rec), &len) &&
+      len >= offsetof(SlotIndexRecord, names) && rec.version == SLOT_INDEX_VERSION) {
+    uint8_t count = (len - offsetof(SlotIndexRecord, names)) / sizeof(uint64_t);
+    if (count > rec.count) count = rec.count;
+    if (count > SAVE_SLOT_COUNT) count = SAVE_SLOT_COUNT;
+    for (uint8_t i = 0; i < count; i++) {
+      if (rec.names[i]) unpackName(rec.names[i], s_names[i]);
+    }
+    if (rec.active < SAVE_SLOT_COUNT) s_active = rec.active;
+  }
+
+  saveStateSetSlot(s_active);
+  KB_LOGI("[Slots] Active slot %u \"%s\"", s_active, s_names[s_active]);
+}
+
+uint8_t saveSlotActive() {
+  return s_active;
+}
+
+bool saveSlotUsed(uint8_t slot) {
+  if (slot >= SAVE_SLOT_COUNT) return false;
+  if (cacheValid(slot) || saveJournalHasRecord(slot)) return true;
+  // Slot 0 may still only have the legacy NVS save
+  return slot == 0 && saveStateHasLegacy();
+}
+
+const char* saveSlotName(uint8_t slot) {
+  return (slot < SAVE_SLOT_COUNT) ? s_names[slot] : "";
+}
+
+bool saveSlotSetName(uint8_t slot, const char* name) {
+  if (slot >= SAVE_SLOT_COUNT || !name) return false;
+  unpackName(packName(name), s_names[slot]);  // Normalize to what the index can store
+  if (!s_names[slot][0]) defaultName(slot, s_names[slot]);
+  return writeIndex();
+}
+
+bool saveSlotSetActive(uint8_t slot) {
+  if (slot >= SAVE_SLOT_COUNT) return false;
+  if (slot == s_active) return true;
+  s_active = slot;
+  saveStateSetSlot(slot);
+  KB_LOGI("[Slots] Active slot %u \"%s\"", s_active, s_names[s_active]);
+  return writeIndex();
+}
+
+bool saveSlotSnapshot(cpu_state_t* state, uint8_t slot) {
+  if (slot >= SAVE_SLOT_COUNT) return false;
+
+  saveStateCapture(state, &s_cache[slot]);
+  s_cached[slot] = true;
+
+  bool ok = saveJournalAppend(slot, &s_cache[slot], sizeof(SaveImage));
+  s_cacheSeq[slot] = saveJournalLatestSeq(slot);
+  if (!ok) KB_LOGW("[Slots] Snapshot of slot %u kept in RAM only", slot);
+  return ok;
+}
+
+bool saveSlotRestore(cpu_state_t* state, uint8_t slot) {
+  if (slot >= SAVE_SLOT_COUNT) return false;
+
+  if (!cacheValid(slot)) {
+    uint16_t len = 0;
+    s_cached[slot] = false;
+    if (!saveJournalReadLatest(slot, &s_cache[slot], sizeof(SaveImage), &len) || len != sizeof(SaveImage) ||
+        !saveStateValid(&s_cache[slot])) {
+      return false;
+    }
+    s_cached[slot] = true;
+    s_cacheSeq[slot] = saveJournalLatestSeq(slot);
+  }
+
+  saveStateApply(state, &s_cache[slot]);
+  KB_LOGI("[Slots] Restored slot %u \"%s\"", slot, s_names[slot]);
+  return true;
+}
@@ -0,0 +1,139 @@
+// save_trigger.cpp
+// KidsBar: event-driven save triggers with a flash-write budget (see save_trigger.h).
+#include "save_trigger.h"
+
+#include "config.h"
+#include "savestate.h"
+#include "log_ring.h"
+
+extern "C" {
+#include "hw.h"
+}
+
+// RAM is only compared against the baseline this often
+static const uint32_t SAVE_DIRTY_CHECK_MS = 1000;
+
+static cpu_state_t* s_state = nullptr;
+static u4_t s_baseline[MEMORY_SIZE];  // RAM as of the last save
+
+static u32_t s_seenEdges = 0;
+static bool s_inputPending = false;
+static uint32_t s_lastInputMs = 0;
+
+static uint32_t s_lastCheckMs = 0;
+static uint32_t s_lastSaveMs = 0;
+static uint16_t s_dirty = 0;
+
+static uint8_t s_tokens = SAVE_BUDGET_BURST;
+static uint32_t s_lastRefillMs = 0;
+
+static uint32_t s_counts[SAVE_REASON_COUNT];
+
+static const char* const REASON_NAMES[SAVE_REASON_COUNT] = {"dirty", "input", "age", "sleep", "brownout"};
+
+// Nibbles that differ between the live RAM and the baseline (2 per byte)
+static uint16_t countDirtyNibbles() {
+  cpu_get_state(s_state);  // memory is not a live view with CPU_UNPACKED_RAM
+  const u4_t* mem = s_state->memory;
+  uint16_t count = 0;
+  for (uint16_t i = 0; i < MEMORY_SIZE; i++) {
+    uint8_t d = mem[i] ^ s_baseline[i];
+    count += ((d & 0x0F) != 0) + ((d & 0xF0) != 0);
+  }
+  return count;
+}
+
+static void refillBudget(uint32_t now) {
+  while (s_tokens < SAVE_BUDGET_BURST && now - s_lastRefillMs >= SAVE_BUDGET_REFILL_MS) {
+    s_tokens++;
+    s_lastRefillMs += SAVE_BUDGET_REFILL_MS;
+  }
+  if (s_tokens >= SAVE_BUDGET_BURST) s_lastRefillMs = now;
+}
+
+static void markSaved(SaveReason reason) {
+  memcpy(s_baseline, s_state->memory, sizeof(s_baseline));
+  s_dirty = 0;
+  s_inputPending = false;
+  s_lastSaveMs = millis();
+  if (s_tokens) s_tokens--;
+  s_counts[reason]++;
+  KB_LOGI("[Save] Triggered by %s (%u writes left in budget)", REASON_NAMES[reason], s_tokens);
+  saveStateLogLatency();
+}
+
+void saveTriggerBegin(cpu_state_t* state) {
+  s_state = state;
+  cpu_get_state(s_state);
+  memcpy(s_baseline, s_state->memory, sizeof(s_baseline));
+
+  uint32_t now = millis();
+  s_seenEdges = hw_get_input_edges();
+  s_inputPending = false;
+  s_dirty = 0;
+  s_lastCheckMs = now;
+  s_lastSaveMs = now;
+  s_tokens = SAVE_BUDGET_BURST;
+  s_lastRefillMs = now;
+}
+
+void saveTriggerPoll() {
+  if (!s_state) return;
+  uint32_t now = millis();
+
+  u32_t edges = hw_get_input_edges();
+  if (edges != s_seenEdges) {
+    s_seenEdges = edges;
+    s_inputPending = true;
+    s_lastInputMs = now;
+  }
+
+  if (now - s_lastCheckMs < SAVE_DIRTY_CHECK_MS) return;
+  s_lastCheckMs = now;
+
+  refillBudget(now);
+  s_dirty = countDirtyNibbles();
+  if (s_dirty == 0) {
+    s_inputPending = false;
+    return;
+  }
+
+  SaveReason reason;
+  if (s_inputPending && now - s_lastInputMs >= SAVE_INPUT_QUIET_MS) {
+    reason = SAVE_REASON_INPUT;
+  } else if (s_dirty >= SAVE_DIRTY_NIBBLES) {
+    reason = SAVE_REASON_DIRTY;
+  } else if (now - s_lastSaveMs >= SAVE_MAX_AGE_MS) {
+    reason = SAVE_REASON_AGE;
+  } else {
+    return;
+  }
+
+  // Out of budget, or the previous write is still in flight: try again next check
+  if (s_tokens == 0 || !saveStateRequest(s_state)) return;
+  markSaved(reason);
+}
+
+void saveTriggerNow(SaveReason reason) {
+  if (!s_state || reason >= SAVE_REASON_COUNT) return;
+  saveStateToEEPROM(s_state);
+  markSaved(reason);
+}
+
+uint16_t saveTriggerDirtyNibbles() {
+  return s_state ? countDirtyNibbles() : 0;
+}
+
+uint32_t saveTriggerSinceSaveMs() {
+  return millis() - s_lastSaveMs;
+}
+
+uint32_t saveTriggerCount(SaveReason reason) {
+  return (reason < SAVE_REASON_COUNT) ? s_counts[reason] : 0;
+}
+
+uint32_t saveTriggerTotal() {
+  uint32_t n = 0;
+  for (uint8_t r = 0; r < SAVE_REASON_COUNT; r++) n += s_counts[r];
+  return n;
+}
@@ -1,5 +1,7 @@
 /*
- * Savestate implementation for ESP32 using Preferences (NVS)
+ * Savestate implementation for ESP32
+ * Saves go to the append-only journal on the spiffs partition (save_journal.h);
+ * Preferences (NVS) is kept as a fallback and for saves made by older firmware.
  * Adapted from ArduinoGotchi EEPROM version
  */
 
@@ -7,9 +9,15 @@
 #include <Preferences.h>
 #include "savestate.h"
 #include "hardcoded_state.h"
+#include "save_journal.h"
+#include "log_ring.h"
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
 
 extern "C" {
 #include "cpu.h"
+#include "lcd_history.h"
 }
 
 // NVS namespace
@@ -21,69 +29,251 @@ extern "C" {
 // Magic number to verify valid save
 #define SAVE_MAGIC 0x54414D41  // "TAMA"
 
+static_assert(sizeof(SaveImage) <= JOURNAL_MAX_PAYLOAD, "save image does not fit a journal record");
+
+// Save latency histogram bucket upper bounds (last bucket = everything above)
+static const uint32_t SAVE_LATENCY_BOUNDS_US[SAVE_LATENCY_BUCKETS - 1] = {100, 500, 1000, 2000, 5000, 10000, 50000};
+
 static Preferences prefs;
+static SaveImage image;    // Load buffer
+static SaveImage staging;  // Snapshot waiting to be persisted
+static uint8_t s_stagingSlot = 0;
+static uint32_t s_stagingSeq = 0;  // Journal record staging was written to (0 = not in the journal)
+
+// Journal slot of the game being played (slot 0 also has the legacy NVS copy)
+static uint8_t s_slot = 0;
+
+// Set by the loop once staging holds a snapshot, cleared by the persist task
+static volatile bool s_pending = false;
+static TaskHandle_t s_persistTaskHandle = nullptr;
+
+static uint32_t s_snapshotHist[SAVE_LATENCY_BUCKETS];  // Time the loop spends (stall)
+static uint32_t s_persistHist[SAVE_LATENCY_BUCKETS];   // Time the flash write takes
+static uint32_t s_loopHist[SAVE_LATENCY_BUCKETS];      // Loop iterations a save overlapped
+static volatile bool s_loopOverlap = false;            // A save started or ended this iteration
+
+void saveStateCapture(cpu_state_t *state, SaveImage *out) {
+  cpu_get_state(state);
+  out->cpu = *state;
+  out->cpu.memory = NULL;
+  memcpy(out->memory, state->memory, sizeof(out->memory));
+}
+
+// Keeps the emulator's own memory pointer
+void saveStateApply(cpu_state_t *state, const SaveImage *in) {
+  cpu_get_state(state);
+  u4_t *memory = state->memory;
+  *state = in->cpu;
+  state->memory = memory;
+  memcpy(memory, in->memory, sizeof(in->memory));
+  cpu_set_state(state);
+  lcd_history_reset();  // The frames kept belong to the timeline left behind
+}
+
+bool saveStateValid(const SaveImage *in) {
+  return cpu_check_state(&in->cpu);
+}
+
+void saveStateSetSlot(uint8_t slot) {
+  if (slot >= JOURNAL_MAX_SLOTS) return;
+  while (s_pending) vTaskDelay(1);
+  s_slot = slot;
+}
+
+uint8_t saveStateSlot() {
+  return s_slot;
+}
 
 void initEEPROM() {
   Serial.println(F("[Storage] Initializing NVS..."));
   prefs.begin(NVS_NAMESPACE, false);
+
+  if (saveJournalBegin()) {
+    saveJournalStartTask();
+  }
+  saveStateStartTask();
 }
 
 bool validEEPROM() {
-  uint32_t magic = prefs.getUInt(NVS_KEY_MAGIC, 0);
-  return (magic == SAVE_MAGIC);
+  if (saveJournalHasRecord(s_slot)) return true;
+  return s_slot == 0 && saveStateHasLegacy();
 }
 
-void saveStateToEEPROM(cpu_state_t *state) {
-  Serial.println(F("[Storage] Saving state to NVS..."));
+bool saveStateHasLegacy() {
+  return prefs.getUInt(NVS_KEY_MAGIC, 0) == SAVE_MAGIC;
+}
 
-  cpu_get_state(state);
+// Snapshot the CPU into the staging image (registers + RAM memcpy, no flash access)
+static void snapshotState(cpu_state_t *state) {
+  saveStateCapture(state, &staging);
+  s_stagingSlot = s_slot;
+  s_stagingSeq = 0;
+}
+
+// Write the staging image to flash (journal, NVS as fallback). May block for an erase.
+static void persistStaging() {
+  if (saveJournalReady()) {
+    if (saveJournalAppend(s_stagingSlot, &staging, sizeof(staging))) {
+      s_stagingSeq = saveJournalLatestSeq(s_stagingSlot);
+      KB_LOGI("[Storage] State saved to journal slot %u (#%lu)", s_stagingSlot, (unsigned long)s_stagingSeq);
+      return;
+    }
+    KB_LOGW("[Storage] Journal write failed, falling back to NVS");
+  }
+  if (s_stagingSlot != 0) {
+    KB_LOGE("[Storage] Slot %u can only be saved to the journal", s_stagingSlot);
+    return;
+  }
 
   // Save CPU state
-  prefs.putBytes(NVS_KEY_STATE, (const uint8_t *)state, sizeof(cpu_state_t));
+  prefs.putBytes(NVS_KEY_STATE, (const uint8_t *)&staging.cpu, sizeof(cpu_state_t));
 
   // Save memory separately
-  prefs.putBytes(NVS_KEY_MEMORY, (const uint8_t *)state->memory, MEMORY_SIZE * sizeof(u4_t));
+  prefs.putBytes(NVS_KEY_MEMORY, (const uint8_t *)staging.memory, MEMORY_SIZE * sizeof(u4_t));
 
   // Save magic number
   prefs.putUInt(NVS_KEY_MAGIC, SAVE_MAGIC);
 
-  Serial.println(F("[Storage] State saved successfully"));
+  KB_LOGI("[Storage] State saved to NVS");
+}
+
+static void latencyRecord(uint32_t* hist, uint32_t us) {
+  uint8_t i = 0;
+  while (i < SAVE_LATENCY_BUCKETS - 1 && us >= SAVE_LATENCY_BOUNDS_US[i]) i++;
+  hist[i]++;
+}
+
+static void persistTask(void* arg) {
+  (void)arg;
+  while (true) {
+    ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+    if (!s_pending) continue;
+
+    uint32_t t0 = micros();
+    persistStaging();
+    latencyRecord(s_persistHist, micros() - t0);
+    s_pending = false;
+    s_loopOverlap = true;
+  }
+}
+
+void saveStateStartTask(uint8_t priority, uint8_t core) {
+  if (s_persistTaskHandle) return;
+  if (core > 1) core = 0;
+  xTaskCreatePinnedToCore(persistTask, "savePersist", 4096, nullptr, priority, &s_persistTaskHandle, core);
+}
+
+bool saveStateRequest(cpu_state_t *state) {
+  // Previous save still being written: the caller retries on a later loop
+  if (s_pending) return false;
+
+  uint32_t t0 = micros();
+  snapshotState(state);
+  s_pending = true;
+  s_loopOverlap = true;
+  latencyRecord(s_snapshotHist, micros() - t0);
+
+  if (s_persistTaskHandle) {
+    xTaskNotifyGive(s_persistTaskHandle);
+  } else {
+    persistStaging();
+    s_pending = false;
+  }
+  return true;
 }
 
-void loadStateFromEEPROM(cpu_state_t *state) {
+bool saveStateBusy() {
+  return s_pending;
+}
+
+const SaveImage* saveStatePersisted(uint8_t* slot, uint32_t* seq) {
+  // s_stagingSeq is published before s_pending drops, and only the loop snapshots
+  if (s_pending || s_stagingSeq == 0) return nullptr;
+  *slot = s_stagingSlot;
+  *seq = s_stagingSeq;
+  return &staging;
+}
+
+void saveStateToEEPROM(cpu_state_t *state) {
+  while (s_pending) vTaskDelay(1);
+  snapshotState(state);
+  persistStaging();
+}
+
+void saveStateRecordLoop(uint32_t us) {
+  // Flash writes suspend the cache on both cores: the loop stalls wherever it is
+  bool overlap = s_loopOverlap || s_pending;
+  s_loopOverlap = false;
+  if (overlap) latencyRecord(s_loopHist, us);
+}
+
+void saveStateLogLatency() {
+  char line[160];
+  int n = 0;
+  for (uint8_t i = 0; i < SAVE_LATENCY_BUCKETS; i++) {
+    n += snprintf(line + n, sizeof(line) - n, " %lu/%lu/%lu", (unsigned long)s_loopHist[i],
+                  (unsigned long)s_snapshotHist[i], (unsigned long)s_persistHist[i]);
+  }
+  KB_LOGI("[Storage] Save latency loop/snapshot/persist <0.1,0.5,1,2,5,10,50,inf ms:%s", line);
+}
+
+bool loadStateFromEEPROM(cpu_state_t *state) {
+  uint16_t len = 0;
+  if (saveJournalReadLatest(s_slot, &image, sizeof(image), &len)) {
+    if (len == sizeof(image) && saveStateValid(&image)) {
+      saveStateApply(state, &image);
+      Serial.printf("[Storage] State loaded from journal slot %u (#%lu)\n", s_slot,
+                    (unsigned long)saveJournalLatestSeq(s_slot));
+      return true;
+    }
+    Serial.println(F("[Storage] Journal record rejected (size or contents)"));
+  }
+  if (s_slot != 0) {
+    Serial.println(F("[Storage] No valid save found"));
+    return false;
+  }
+
   Serial.println(F("[Storage] Loading state from NVS..."));
 
-  if (!validEEPROM()) {
+  if (prefs.getUInt(NVS_KEY_MAGIC, 0) != SAVE_MAGIC) {
     Serial.println(F("[Storage] No valid save found"));
-    return;
+    return false;
   }
 
   // Load CPU state
   size_t stateSize = prefs.getBytesLength(NVS_KEY_STATE);
   if (stateSize != sizeof(cpu_state_t)) {
     Serial.println(F("[Storage] State size mismatch"));
-    return;
+    return false;
   }
 
-  prefs.getBytes(NVS_KEY_STATE, (uint8_t *)state, sizeof(cpu_state_t));
-
   // Load memory
   size_t memSize = prefs.getBytesLength(NVS_KEY_MEMORY);
   if (memSize != MEMORY_SIZE * sizeof(u4_t)) {
     Serial.println(F("[Storage] Memory size mismatch"));
-    return;
+    return false;
   }
 
-  prefs.getBytes(NVS_KEY_MEMORY, (uint8_t *)state->memory, MEMORY_SIZE * sizeof(u4_t));
-
-  cpu_set_state(state);
+  // Read into the image first: the stored struct carries a stale memory pointer
+  prefs.getBytes(NVS_KEY_STATE, (uint8_t *)&image.cpu, sizeof(cpu_state_t));
+  prefs.getBytes(NVS_KEY_MEMORY, (uint8_t *)image.memory, MEMORY_SIZE * sizeof(u4_t));
+  if (!saveStateValid(&image)) {
+    Serial.println(F("[Storage] State rejected"));
+    return false;
+  }
+  saveStateApply(state, &image);
 
   Serial.println(F("[Storage] State loaded successfully"));
+  return true;
 }
 
 void eraseStateFromEEPROM() {
   Serial.println(F("[Storage] Erasing saved state..."));
-  prefs.clear();
+  while (s_pending) vTaskDelay(1);
+  if (s_slot == 0) prefs.clear();
+  if (saveJournalReady()) {
+    saveJournalAppend(s_slot, NULL, 0);  // Tombstone
+  }
   Serial.println(F("[Storage] State erased"));
 }
 
@@ -107,6 +297,7 @@ void loadHardcodedState(cpu_state_t* cpuState) {
 
   cpuState->memory = memTemp;
   cpu_set_state(cpuState);
+  lcd_history_reset();
 
   Serial.println(F("[Storage] Hardcoded state loaded - Tamagotchi egg ready!"));
 }
@@ -12,14 +12,59 @@ extern "C" {
 
 #define EEPROM_MAGIC_NUMBER 0x12
 
+// Pointer-free save payload: CPU registers followed by the packed RAM.
+// The memory pointer inside cpu is never trusted when loading.
+struct SaveImage {
+  cpu_state_t cpu;
+  u4_t memory[MEMORY_SIZE];
+};
+
+// Copy registers + RAM out of / into the emulator (a few microseconds, no flash).
+void saveStateCapture(cpu_state_t* cpuState, SaveImage* out);
+void saveStateApply(cpu_state_t* cpuState, const SaveImage* in);
+
+// True if the image is safe to apply (cpu_check_state). Everything read back from
+// flash or RTC memory goes through this: a CRC does not catch a layout change.
+bool saveStateValid(const SaveImage* in);
+
+// Journal slot that load/save/erase use for the game being played (default 0).
+void saveStateSetSlot(uint8_t slot);
+uint8_t saveStateSlot();
+
 void initEEPROM();
 
 bool validEEPROM();
 
-void loadStateFromEEPROM(cpu_state_t* cpuState);
+// True if the pre-journal NVS save is present (it belongs to slot 0).
+bool saveStateHasLegacy();
+
+// Returns false if no usable save was found (CPU state left untouched).
+bool loadStateFromEEPROM(cpu_state_t* cpuState);
 
 void eraseStateFromEEPROM();
 
+// Synchronous save (snapshot + flash write); waits for a background save in flight.
 void saveStateToEEPROM(cpu_state_t* cpuState);
 
+// Background save: snapshot registers + RAM into a staging buffer (a memcpy,
+// safe between instruction batches) and let a low-priority task write it.
+// Returns false without snapshotting if the previous save is still being written.
+bool saveStateRequest(cpu_state_t* cpuState);
+bool saveStateBusy();
+
+// The image the last save wrote to the journal, with its slot and record sequence,
+// read from RAM. nullptr while a save is in flight or if it did not reach the
+// journal. Loop side only: valid until the next saveStateRequest().
+const SaveImage* saveStatePersisted(uint8_t* slot, uint32_t* seq);
+void saveStateStartTask(uint8_t priority = 1, uint8_t core = 0);
+
+// Histogram of loop-side snapshot time vs background write time, plus the loop
+// iterations a save overlapped (the stall the game actually sees).
+#define SAVE_LATENCY_BUCKETS 8
+void saveStateLogLatency();
+
+// Time of one loop() iteration, sleeps excluded. Only iterations during which a
+// save was snapshotted or written are counted.
+void saveStateRecordLoop(uint32_t us);
+
 void loadHardcodedState(cpu_state_t* cpuState);
\ No newline at end of file
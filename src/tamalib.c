@@ -21,9 +21,15 @@
 #include "hw.h"
 #include "cpu.h"
 #include "hal.h"
+#include "lcd_history.h"
 
 #define DEFAULT_FRAMERATE				3// fps
 
+/* Adaptive framerate tuning */
+#define ADAPTIVE_BURST_CHANGES			48 // LCD transitions per max-framerate frame that count as an animation burst
+#define ADAPTIVE_HOLD_SECONDS			3 // Stay at the max framerate this long after an input
+#define ADAPTIVE_EVENT_ONLY			0xFFFFFFFF // Frame period meaning "never refresh on our own"
+
 static exec_mode_t exec_mode = EXEC_MODE_RUN;
 
 static u32_t step_depth = 0;
@@ -34,6 +40,14 @@ static u32_t ts_freq;
 
 static u8_t g_framerate = DEFAULT_FRAMERATE;
 
+/* Adaptive mode, enabled when adaptive_fast_period != 0 */
+static u32_t adaptive_fast_period = 0;
+static u32_t adaptive_slow_period = 0;
+static u32_t frame_period = 0;
+static timestamp_t input_ts = 0;
+static u32_t seen_lcd_changes = 0;
+static u32_t seen_input_edges = 0;
+
 hal_t *g_hal;
 
 
@@ -48,6 +62,8 @@ bool_t tamalib_init(u32_t freq)
 
 	ts_freq = freq;
 
+	lcd_history_reset();
+
 	return res;
 }
 
@@ -62,6 +78,25 @@ void tamalib_release(void)
 void tamalib_set_framerate(u8_t framerate)
 {
 	g_framerate = framerate;
+	adaptive_fast_period = 0;
+}
+
+void tamalib_set_adaptive_framerate(u8_t max_fps, u32_t idle_period)
+{
+	if (max_fps == 0) {
+		tamalib_set_framerate(DEFAULT_FRAMERATE);
+		return;
+	}
+
+	adaptive_fast_period = ts_freq/max_fps;
+	adaptive_slow_period = (idle_period != 0) ? ts_freq * idle_period : ADAPTIVE_EVENT_ONLY;
+	if (adaptive_slow_period < adaptive_fast_period) {
+		adaptive_slow_period = adaptive_fast_period;
+	}
+
+	frame_period = adaptive_fast_period;
+	seen_lcd_changes = hw_get_lcd_changes();
+	seen_input_edges = hw_get_input_edges();
 }
 /*
 u8_t tamalib_get_framerate(void)
@@ -75,14 +110,17 @@ void tamalib_register_hal(hal_t *hal)
 {
 	g_hal = hal;
 }
-/*
 void tamalib_set_exec_mode(exec_mode_t mode)
 {
 	exec_mode = mode;
 	step_depth = cpu_get_depth();
 	cpu_sync_ref_timestamp();
 }
-*/
+
+exec_mode_t tamalib_get_exec_mode(void)
+{
+	return exec_mode;
+}
 
 /*
 void tamalib_step(void)
@@ -144,6 +182,52 @@ void tamalib_mainloop(void)
 	}
 } */
 
+/* A burst is a rate: changes accumulated over a long idle period do not count as one */
+static bool_t adaptive_burst(u32_t changes, timestamp_t ts)
+{
+	u32_t elapsed = ts - screen_ts;
+
+	if (elapsed < adaptive_fast_period) {
+		elapsed = adaptive_fast_period;
+	}
+
+	return (uint64_t) changes * adaptive_fast_period >= (uint64_t) ADAPTIVE_BURST_CHANGES * elapsed;
+}
+
+static void adaptive_update_screen(timestamp_t ts)
+{
+	u32_t changes = hw_get_lcd_changes() - seen_lcd_changes;
+	u32_t edges = hw_get_input_edges();
+	bool_t burst = adaptive_burst(changes, ts);
+
+	/* Inputs and animation bursts snap back to the max framerate right away */
+	if (edges != seen_input_edges) {
+		seen_input_edges = edges;
+		input_ts = ts;
+		frame_period = adaptive_fast_period;
+	} else if (burst) {
+		frame_period = adaptive_fast_period;
+	}
+
+	if (ts - screen_ts < frame_period) {
+		return;
+	}
+	screen_ts = ts;
+
+	/* Otherwise halve the framerate at each frame, down to the idle one */
+	if (!burst && ts - input_ts >= ts_freq * ADAPTIVE_HOLD_SECONDS) {
+		frame_period = (frame_period > adaptive_slow_period/2) ? adaptive_slow_period : frame_period * 2;
+	}
+
+	/* Nothing to show, do not pay for a refresh */
+	if (changes == 0) {
+		return;
+	}
+
+	seen_lcd_changes += changes;
+	g_hal->update_screen();
+}
+
 void tamalib_mainloop_step_by_step(void)
 {
   timestamp_t ts;
@@ -156,13 +240,17 @@ void tamalib_mainloop_step_by_step(void)
         exec_mode = EXEC_MODE_PAUSE;
         step_depth = cpu_get_depth();
       }
+
+      lcd_history_vsync();
     }
 
 
-    /* Update the screen @ g_framerate fps */
+    /* Update the screen @ g_framerate fps, or as the LCD activity dictates */
     ts = g_hal->get_timestamp();
-    
-    if (ts - screen_ts >= ts_freq/g_framerate) {
+
+    if (adaptive_fast_period != 0) {
+      adaptive_update_screen(ts);
+    } else if (ts - screen_ts >= ts_freq/g_framerate) {
     //if (ts - screen_ts >= ts_freq/DEFAULT_FRAMERATE) {
       screen_ts = ts;
       g_hal->update_screen();
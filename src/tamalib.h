@@ -56,11 +56,22 @@ bool_t tamalib_init(u32_t freq);
 
 
 void tamalib_set_framerate(u8_t framerate);
+
+/* Refresh at up to max_fps while the LCD is animating or right after an input,
+ * then back off to one refresh every idle_period seconds (0 = only after inputs).
+ * Frames without any LCD change are never pushed to the HAL.
+ * tamalib_set_framerate() goes back to a fixed framerate.
+ */
+void tamalib_set_adaptive_framerate(u8_t max_fps, u32_t idle_period);
 //u8_t tamalib_get_framerate(void);
 
 void tamalib_register_hal(hal_t *hal);
 
-//void tamalib_set_exec_mode(exec_mode_t mode);
+void tamalib_set_exec_mode(exec_mode_t mode);
+
+/* EXEC_MODE_PAUSE once cpu_step() failed (PC outside the ROM): the core stays
+ * stopped until the application loads a state and sets EXEC_MODE_RUN again */
+exec_mode_t tamalib_get_exec_mode(void);
 
 /* NOTE: Only one of these two functions must be used in the main application
  * (tamalib_step() should be used only if tamalib_mainloop() does not fit the
@@ -0,0 +1,15 @@
+/*
+ * KidsBar - Host stand-in for <avr/pgmspace.h>
+ *
+ * On the host the ROM and op-code tables are plain const data.
+ */
+#ifndef _HOST_PGMSPACE_H_
+#define _HOST_PGMSPACE_H_
+
+#define PROGMEM
+
+#define pgm_read_byte_near(addr)	(*(const unsigned char *) (addr))
+#define pgm_read_word_near(addr)	(*(const unsigned short *) (addr))
+#define pgm_read_ptr_near(addr)		(*(void * const *) (addr))
+
+#endif /* _HOST_PGMSPACE_H_ */
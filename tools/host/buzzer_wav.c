@@ -0,0 +1,151 @@
+/*
+ * KidsBar - Render the buzzer of a scripted run
+ *
+ * Runs the ROM from reset with a fixed set of presses, as fast as the host
+ * can, and writes what the buzzer did: <prefix>.txt holds one
+ * "<ticks> <freq> <on>" line per change (buzzer_trace_format()), to diff
+ * across core changes, and <prefix>.wav the square wave to listen to.
+ *
+ * Usage: buzzer_wav [seconds] [prefix]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "host_hal.h"
+#include "buzzer_trace.h"
+#include "tamalib.h"
+
+#define DEFAULT_SECONDS		300
+#define WAV_RATE		16384 // Hz, a divider of the tick rate
+#define BATCH_TICKS		256 // LOOP_BATCH_TICKS (config.h): far fewer changes than BUZZER_TRACE_DEPTH
+#define DRAIN_CHUNK		64
+#define PRESS_MS		200
+
+typedef struct {
+	button_t btn;
+	u32_t at_ms; // Emulated time of the press
+} press_t;
+
+/* Walk the menu once the ROM has started and let it beep */
+static const press_t presses[] = {
+	{ BTN_MIDDLE, 20000 },
+	{ BTN_RIGHT, 25000 },
+	{ BTN_LEFT, 30000 },
+	{ BTN_MIDDLE, 35000 },
+	{ BTN_RIGHT, 60000 },
+	{ BTN_MIDDLE, 62000 },
+};
+
+static FILE *wav_file;
+static FILE *txt_file;
+static buzzer_wav_t wav;
+static u32_t change_count = 0;
+
+
+static u32_t ms_to_ticks(u32_t ms)
+{
+	return (u32_t) (((uint64_t) ms * TICK_FREQUENCY + 999) / 1000);
+}
+
+static void write_wav(const u8_t *data, u32_t len, void *ctx)
+{
+	fwrite(data, 1, len, (FILE *) ctx);
+}
+
+static void drain(void)
+{
+	buzzer_change_t changes[DRAIN_CHUNK];
+	char line[40];
+	u32_t n, i;
+
+	while ((n = buzzer_trace_read(changes, DRAIN_CHUNK)) != 0) {
+		for (i = 0; i < n; i++) {
+			buzzer_trace_format(&changes[i], line, sizeof(line));
+			fputs(line, txt_file);
+		}
+		buzzer_wav_render(&wav, changes, n);
+		change_count += n;
+	}
+}
+
+static FILE *open_output(const char *prefix, const char *ext, const char *mode)
+{
+	char path[256];
+	FILE *f;
+
+	snprintf(path, sizeof(path), "%s%s", prefix, ext);
+	f = fopen(path, mode);
+	if (f == NULL) {
+		perror(path);
+	}
+	return f;
+}
+
+int main(int argc, char **argv)
+{
+	u32_t seconds = (argc > 1) ? strtoul(argv[1], NULL, 0) : DEFAULT_SECONDS;
+	const char *prefix = (argc > 2) ? argv[2] : "buzzer";
+	u8_t header[BUZZER_WAV_HEADER_SIZE] = { 0 };
+	struct timespec t0, t1;
+	double wall_s;
+	u32_t start, end, batch_end, next, i;
+	bool_t stopped = 0;
+
+	if (host_hal_init()) {
+		fprintf(stderr, "TamaLIB init failed\n");
+		return 2;
+	}
+
+	wav_file = open_output(prefix, ".wav", "wb");
+	txt_file = open_output(prefix, ".txt", "w");
+	if (wav_file == NULL || txt_file == NULL) {
+		return 2;
+	}
+
+	start = cpu_get_ticks();
+	end = start + seconds * TICK_FREQUENCY;
+	for (i = 0; i < sizeof(presses) / sizeof(presses[0]); i++) {
+		hw_queue_button(presses[i].btn, BTN_STATE_PRESSED, start + ms_to_ticks(presses[i].at_ms));
+		hw_queue_button(presses[i].btn, BTN_STATE_RELEASED, start + ms_to_ticks(presses[i].at_ms + PRESS_MS));
+	}
+
+	/* The header goes in once the length is known */
+	fwrite(header, 1, sizeof(header), wav_file);
+	buzzer_wav_begin(&wav, WAV_RATE, start, &write_wav, wav_file);
+
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	while (!stopped && (int32_t) (cpu_get_ticks() - end) < 0) {
+		/* Batches as in the firmware loop (runBatch(), main.cpp): inputs go in between,
+		 * and a batch ends early at the next queued change */
+		hw_apply_inputs(cpu_get_ticks());
+		batch_end = cpu_get_ticks() + BATCH_TICKS;
+		if (hw_next_input_tick(&next) && (int32_t) (next - batch_end) < 0) {
+			batch_end = next;
+		}
+
+		do {
+			if (cpu_step()) {
+				fprintf(stderr, "CPU stopped after %lu ticks\n", (unsigned long) (cpu_get_ticks() - start));
+				stopped = 1;
+				break;
+			}
+		} while ((int32_t) (cpu_get_ticks() - batch_end) < 0);
+		drain();
+	}
+	buzzer_wav_render_until(&wav, cpu_get_ticks());
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+
+	buzzer_wav_header(header, WAV_RATE, wav.samples);
+	fseek(wav_file, 0, SEEK_SET);
+	fwrite(header, 1, sizeof(header), wav_file);
+	fclose(wav_file);
+	fclose(txt_file);
+
+	wall_s = (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9;
+	printf("%s: %u changes, %u samples (%u s emulated in %.2f s, %.0fx real time)\n",
+		prefix, change_count, wav.samples, seconds, wall_s, wall_s > 0 ? seconds / wall_s : 0);
+
+	return buzzer_trace_dropped() ? 1 : 0;
+}
@@ -0,0 +1,197 @@
+/*
+ * KidsBar - Save state fuzzer for cpu_check_state()
+ *
+ * Takes real states from a run of the ROM, mutates them the ways a flash image
+ * gets damaged (bit flips, overwritten bytes, a write cut short) and checks
+ * that cpu_check_state() accepts every real state and that whatever it accepts
+ * can run. Some accepted images are applied and stepped: build with
+ * SANITIZE=1 to catch out-of-bounds accesses there.
+ *
+ * Usage: fuzz_state [cases] [seed]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "host_hal.h"
+#include "tamalib.h"
+
+#define SEED_COUNT		512
+#define SEED_STEPS		20000 // Steps between two seed states
+#define RUN_EVERY		100 // Accepted images run once every RUN_EVERY
+#define RUN_STEPS		2000
+#define DEFAULT_CASES		3000000
+
+/* Same layout as SaveImage (savestate.h) */
+typedef struct {
+	cpu_state_t cpu;
+	u4_t memory[MEMORY_SIZE];
+} image_t;
+
+typedef enum {
+	MUT_BIT_FLIP = 0,
+	MUT_OVERWRITE,
+	MUT_TRUNCATE,
+	MUT_NUM,
+} mutation_t;
+
+static const char *mutation_names[MUT_NUM] = { "bit flips", "overwrites", "truncations" };
+
+static image_t seeds[SEED_COUNT];
+static u32_t rng_state;
+
+
+static u32_t rng(void)
+{
+	/* xorshift32 */
+	rng_state ^= rng_state << 13;
+	rng_state ^= rng_state >> 17;
+	rng_state ^= rng_state << 5;
+	return rng_state;
+}
+
+static double now_s(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void capture(image_t *img)
+{
+	cpu_state_t state;
+
+	cpu_get_state(&state);
+	img->cpu = state;
+	img->cpu.memory = NULL;
+	memcpy(img->memory, state.memory, sizeof(img->memory));
+}
+
+/* As saveStateApply(): the core keeps its own memory pointer */
+static void apply(const image_t *img)
+{
+	cpu_state_t state;
+	u4_t *memory;
+
+	cpu_get_state(&state);
+	memory = state.memory;
+	state = img->cpu;
+	state.memory = memory;
+	memcpy(memory, img->memory, sizeof(img->memory));
+	cpu_set_state(&state);
+}
+
+/* Play the ROM with random presses and keep a state every SEED_STEPS steps */
+static void make_seeds(void)
+{
+	u32_t i, j;
+
+	for (i = 0; i < SEED_COUNT; i++) {
+		for (j = 0; j < SEED_STEPS; j++) {
+			if (j % 4096 == 0) {
+				hw_set_button(rng() % 3, (rng() & 3) ? BTN_STATE_RELEASED : BTN_STATE_PRESSED);
+			}
+			cpu_step();
+		}
+		capture(&seeds[i]);
+	}
+}
+
+static void mutate(image_t *img, mutation_t kind)
+{
+	u8_t *bytes = (u8_t *) img;
+	u32_t n, ofs;
+
+	switch (kind) {
+		case MUT_BIT_FLIP:
+			for (n = 1 + rng() % 4; n != 0; n--) {
+				ofs = rng() % (sizeof(*img) * 8);
+				bytes[ofs / 8] ^= 1 << (ofs % 8);
+			}
+			break;
+
+		case MUT_OVERWRITE:
+			bytes[rng() % sizeof(*img)] = rng();
+			break;
+
+		case MUT_TRUNCATE:
+			/* The rest of the record still reads as erased flash */
+			ofs = rng() % sizeof(*img);
+			memset(bytes + ofs, 0xFF, sizeof(*img) - ofs);
+			break;
+
+		default:
+			break;
+	}
+}
+
+int main(int argc, char **argv)
+{
+	u32_t cases = (argc > 1) ? strtoul(argv[1], NULL, 0) : DEFAULT_CASES;
+	u32_t i, j;
+	u32_t false_rejects = 0, accepted = 0, runs = 0, stopped = 0;
+	u32_t tried[MUT_NUM] = { 0 }, passed[MUT_NUM] = { 0 };
+	double start, t0, check_s, run_s = 0;
+	image_t img;
+	mutation_t kind;
+
+	rng_state = (argc > 2) ? strtoul(argv[2], NULL, 0) : 1;
+	if (rng_state == 0) {
+		rng_state = 1;
+	}
+
+	if (host_hal_init()) {
+		fprintf(stderr, "TamaLIB init failed\n");
+		return 2;
+	}
+
+	make_seeds();
+	for (i = 0; i < SEED_COUNT; i++) {
+		if (!cpu_check_state(&seeds[i].cpu)) {
+			false_rejects++;
+		}
+	}
+
+	start = now_s();
+	for (i = 0; i < cases; i++) {
+		kind = rng() % MUT_NUM;
+		img = seeds[rng() % SEED_COUNT];
+		mutate(&img, kind);
+		tried[kind]++;
+
+		if (!cpu_check_state(&img.cpu)) {
+			continue;
+		}
+		passed[kind]++;
+
+		if (++accepted % RUN_EVERY != 0) {
+			continue;
+		}
+
+		t0 = now_s();
+		apply(&img);
+		runs++;
+		for (j = 0; j < RUN_STEPS; j++) {
+			if (cpu_step()) {
+				stopped++;
+				break;
+			}
+		}
+		run_s += now_s() - t0;
+	}
+	check_s = now_s() - start - run_s; // Mutation + check
+
+	printf("seeds: %u real states, %u rejected\n", SEED_COUNT, false_rejects);
+	for (i = 0; i < MUT_NUM; i++) {
+		printf("%s: %u cases, %u accepted\n", mutation_names[i], tried[i], passed[i]);
+	}
+	printf("runs: %u accepted images x %u steps, %u stopped by the PC guard, %u errors logged\n",
+		runs, RUN_STEPS, stopped, host_hal_errors());
+	printf("throughput: %.1fM cases/min checked (%.2f s), %.0f runs/s (%.2f s)\n",
+		check_s > 0 ? cases / check_s * 60 / 1e6 : 0, check_s,
+		run_s > 0 ? runs / run_s : 0, run_s);
+
+	return false_rejects ? 1 : 0;
+}
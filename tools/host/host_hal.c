@@ -0,0 +1,96 @@
+/*
+ * KidsBar - Host HAL for the TamaLIB core
+ */
+#include <stdarg.h>
+#include <stdio.h>
+
+#include "host_hal.h"
+#include "buzzer_trace.h"
+#include "tamalib.h"
+
+static timestamp_t now = 0;
+static u8_t log_mask = 0;
+static u32_t errors = 0;
+
+
+static void hal_halt(void)
+{
+}
+
+static void hal_log(log_level_t level, char *buff, ...)
+{
+	va_list args;
+
+	if (level == LOG_ERROR) {
+		errors++;
+	}
+	if (!(level & log_mask)) {
+		return;
+	}
+
+	va_start(args, buff);
+	vfprintf(stderr, buff, args);
+	va_end(args);
+}
+
+static void hal_sleep_until(timestamp_t ts)
+{
+	if ((int32_t) (ts - now) > 0) {
+		now = ts;
+	}
+}
+
+static timestamp_t hal_get_timestamp(void)
+{
+	return now;
+}
+
+static void hal_update_screen(void)
+{
+}
+
+static void hal_set_frequency(u32_t freq)
+{
+	buzzer_trace_set_frequency(freq);
+}
+
+static void hal_play_frequency(bool_t en)
+{
+	buzzer_trace_play(en);
+}
+
+static int hal_handler(void)
+{
+	return 0;
+}
+
+static hal_t hal = {
+	.halt = &hal_halt,
+	.log = &hal_log,
+	.sleep_until = &hal_sleep_until,
+	.get_timestamp = &hal_get_timestamp,
+	.update_screen = &hal_update_screen,
+	.set_frequency = &hal_set_frequency,
+	.play_frequency = &hal_play_frequency,
+	.handler = &hal_handler,
+};
+
+bool_t host_hal_init(void)
+{
+	now = 0;
+	errors = 0;
+	buzzer_trace_reset();
+	tamalib_register_hal(&hal);
+
+	return tamalib_init(HOST_HAL_TS_FREQ);
+}
+
+void host_hal_set_log_mask(u8_t mask)
+{
+	log_mask = mask;
+}
+
+u32_t host_hal_errors(void)
+{
+	return errors;
+}
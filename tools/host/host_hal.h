@@ -0,0 +1,33 @@
+/*
+ * KidsBar - Host HAL for the TamaLIB core
+ *
+ * Runs the core on a PC without a real clock: timestamps are microseconds of a
+ * virtual clock that sleep_until() jumps forward, so a run goes as fast as the
+ * host can step. Errors logged by the core are counted, and printed on request.
+ * Buzzer changes go to the buzzer trace (buzzer_trace.h), to be read by the tool.
+ */
+#ifndef _HOST_HAL_H_
+#define _HOST_HAL_H_
+
+#include "hal.h"
+
+#define HOST_HAL_TS_FREQ		1000000 // Timestamps are microseconds
+
+#ifdef __cplusplus
+ extern "C" {
+#endif
+
+/* Register the HAL and initialize TamaLIB from reset. Returns 0 on success */
+bool_t host_hal_init(void);
+
+/* Print the messages of the given log levels to stderr (none by default) */
+void host_hal_set_log_mask(u8_t mask);
+
+/* LOG_ERROR messages since host_hal_init() */
+u32_t host_hal_errors(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _HOST_HAL_H_ */